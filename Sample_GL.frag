@@ -2,13 +2,36 @@
 
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
+in vec2 localPosition;
+
+// Circles are drawn as a single quad of half-size circleRadius and cut out
+// here from their signed distance; circleArc is the drawn fraction of the
+// full turn, starting at angle 0 and going anticlockwise.
+// circleRadius is 0 for every other shape
+uniform float circleRadius;
+uniform float circleArc;
 
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
+    float alpha = 1.0;
+    if (circleRadius > 0.0) {
+        float angle = atan(localPosition.y, localPosition.x);
+        if (angle < 0.0)
+            angle += 6.28318530718;
+        if (angle > circleArc * 6.28318530718)
+            discard;
+
+        // Signed distance to the rim, faded over one pixel for anti-aliasing
+        float d = length(localPosition) - circleRadius;
+        alpha = clamp(0.5 - d / fwidth(d), 0.0, 1.0);
+        if (alpha <= 0.0)
+            discard;
+    }
+
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
+    color = vec4(fragColor, alpha);
 }
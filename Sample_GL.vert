@@ -4,18 +4,31 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
 
+// per-instance data : offset (x,y,z) and rotation about z in radians (w),
+// plus a colour multiplier. Non-instanced draws leave these arrays disabled,
+// so they fall back to the constant values (0,0,0,0) and (1,1,1)
+layout (location = 2) in vec4 instanceTransform;
+layout (location = 3) in vec3 instanceColor;
+
 uniform mat4 MVP;
 
 // output data : used by fragment shader
 out vec3 fragColor;
+out vec2 localPosition;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    float c = cos(instanceTransform.w);
+    float s = sin(instanceTransform.w);
+    vec3 p = vec3(c*vertexPosition.x - s*vertexPosition.y, s*vertexPosition.x + c*vertexPosition.y, vertexPosition.z) + instanceTransform.xyz;
+    vec4 v = vec4(p, 1); // Transform an homogeneous 4D vector
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    fragColor = vertexColor * instanceColor;
+
+    // Untransformed position, used to cut circles out of their quad
+    localPosition = vertexPosition.xy;
 
     // Output position of the vertex, in clip space : MVP * position
     gl_Position = MVP * v;
@@ -4,25 +4,53 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <climits>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#ifdef OFFSCREEN_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "game_sim.h"
+#include "input_log.h"
+#include "jobs.h"
+#include "profile.h"
+
 using namespace std;
 
 struct VAO {
     GLuint VertexArrayID;
     GLuint VertexBuffer;
-    GLuint ColorBuffer;
+
+    // Layout of the interleaved VBO
+    int PositionSize;
+    int Stride;
+    bool VertexColors;
+    GLubyte FlatColor[4];
 
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+    int RefCount;
+
+    // VAO for instanced draws of this geometry, 0 until first needed
+    GLuint InstanceArrayID;
+
+    // Circles are a quad cut out in the fragment shader; Radius is 0 otherwise
+    GLfloat Radius;
+    GLfloat Arc;
 };
 typedef struct VAO VAO;
 
@@ -33,74 +61,24 @@ struct GLMatrices {
 	GLuint MatrixID;
 } Matrices;
 
-struct Color {
-	float r;
-	float g;
-	float b;
-};
-typedef struct Color Color;
-
-struct Point {
-    float x;
-	float y;
-};
-typedef struct Point Point;
-
-struct gameObjects {
-	string name;
-	VAO *object;
-	Color color;
-	int status=0;
-	int flag = 0;
-	float x;
-	float y;
-	float speed;
-	float len,breadth,radius;
-	float angle=0;
-};
-typedef struct gameObjects gameObjects;
-
-map <string,gameObjects> Gun;
-map <string,gameObjects> Brick;
-map <string,gameObjects> Basket;
-map <string,gameObjects> Laser;
-map <string,gameObjects> Mirror;
-map <string,gameObjects> Line;
+void geometry_retain (struct VAO* vao);
 
 GLuint programID;
+GLint CircleRadiusID, CircleArcID;
+
+// Run the simulation only: no window, no GL context, no geometry
+bool headless = false;
 
 int fbwidth=600,fbheight=600;
-float red_basket_trans_dir;
-float green_basket_trans_dir;
-bool red_basket_trans_status = false;
-bool green_basket_trans_status = false;
-float gun_trans_dir;
-bool gun_trans_status = false;
-float gun_rot_dir;
-bool gun_rot_status = false;
-float brick_speed = 0.05;
-int laser_trans_status = 0;
 float camera_rotation_angle = 90;
 float triangle_rotation = 0;
 float red_basket_rotation = 0;
-float red_basket_translation = -2.0f;
 float green_basket_rotation = 0;
-float green_basket_translation = 2.0f;
-float gun_rotation = 0;
-float gun_translation = 0;
 float laser_translation = -3.6;
-float click_time;
-int laser_count=1;
-float x_intersection,y_intersection;
-double last_update_time, current_time;
-int brick_cnt = 0;
 int m_flag0=0,m_flag1=0,m_flag2=0,m_flag3=0,zp_flag=0;
 double mouse_x,mouse_y,m_click_x;
 int zoom=0;
 float pan=0;
-int points = 0,misfire=0;
-
-void createRectangle (string comp, string body, Color Color, float l, float b, float x, float y,float angle);
 
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
@@ -192,80 +170,759 @@ void quit(GLFWwindow *window)
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Pack a float colour into normalized RGBA8 */
+void packColor (GLubyte* rgba, GLfloat red, GLfloat green, GLfloat blue)
+{
+    rgba[0] = (GLubyte)(red*255.0f + 0.5f);
+    rgba[1] = (GLubyte)(green*255.0f + 0.5f);
+    rgba[2] = (GLubyte)(blue*255.0f + 0.5f);
+    rgba[3] = 255;
+}
+
+/* Shadow copy of the GL state touched by the draw paths. Every change goes
+   through the state* functions below, which skip the call when the value is
+   already current and count issued vs avoided calls per frame */
+struct GLStateCache {
+    GLuint Program;
+    GLuint VertexArray;
+    GLuint ArrayBuffer;
+    GLenum PolygonMode;
+    GLfloat CircleRadius, CircleArc;
+    GLubyte VertexColor[4];     // constant value of attribute 1
+    bool VertexColorValid;
+    bool InstanceDefaults;      // attributes 2 and 3 hold their constant values
+
+    long FrameIssued, FrameAvoided;     // for the frame in progress
+    long LastIssued, LastAvoided;       // for the previous frame
+    long TotalIssued, TotalAvoided;
+};
+typedef struct GLStateCache GLStateCache;
+
+GLStateCache gl_state;
+
+/* Forget everything; the next call of each kind always reaches GL */
+void stateInvalidate ()
+{
+    gl_state.Program = ~0u;
+    gl_state.VertexArray = ~0u;
+    gl_state.ArrayBuffer = ~0u;
+    gl_state.PolygonMode = GL_NONE;
+    gl_state.CircleRadius = gl_state.CircleArc = -1;
+    gl_state.VertexColorValid = false;
+    gl_state.InstanceDefaults = false;
+}
+
+void stateCount (bool issued, int calls=1)
+{
+    if (issued) {
+        gl_state.FrameIssued += calls;
+        gl_state.TotalIssued += calls;
+    }
+    else {
+        gl_state.FrameAvoided += calls;
+        gl_state.TotalAvoided += calls;
+    }
+}
+
+void stateBeginFrame ()
+{
+    gl_state.LastIssued = gl_state.FrameIssued;
+    gl_state.LastAvoided = gl_state.FrameAvoided;
+    gl_state.FrameIssued = gl_state.FrameAvoided = 0;
+}
+
+void stateUseProgram (GLuint program)
+{
+    bool issue = gl_state.Program != program;
+    if (issue) {
+        glUseProgram (program);
+        gl_state.Program = program;
+        // Uniform values belong to the program
+        gl_state.CircleRadius = gl_state.CircleArc = -1;
+    }
+    stateCount(issue);
+}
+
+void stateBindVertexArray (GLuint vertex_array)
+{
+    bool issue = gl_state.VertexArray != vertex_array;
+    if (issue) {
+        glBindVertexArray (vertex_array);
+        gl_state.VertexArray = vertex_array;
+    }
+    stateCount(issue);
+}
+
+void stateBindArrayBuffer (GLuint buffer)
+{
+    bool issue = gl_state.ArrayBuffer != buffer;
+    if (issue) {
+        glBindBuffer (GL_ARRAY_BUFFER, buffer);
+        gl_state.ArrayBuffer = buffer;
+    }
+    stateCount(issue);
+}
+
+void statePolygonMode (GLenum mode)
+{
+    bool issue = gl_state.PolygonMode != mode;
+    if (issue) {
+        glPolygonMode (GL_FRONT_AND_BACK, mode);
+        gl_state.PolygonMode = mode;
+    }
+    stateCount(issue);
+}
+
+void stateCircle (GLfloat radius, GLfloat arc)
+{
+    bool issue = gl_state.CircleRadius != radius;
+    if (issue) {
+        glUniform1f(CircleRadiusID, radius);
+        gl_state.CircleRadius = radius;
+    }
+    stateCount(issue);
+
+    issue = gl_state.CircleArc != arc;
+    if (issue) {
+        glUniform1f(CircleArcID, arc);
+        gl_state.CircleArc = arc;
+    }
+    stateCount(issue);
+}
+
+void stateVertexColor (const GLubyte* rgba)
+{
+    bool issue = !gl_state.VertexColorValid || memcmp(gl_state.VertexColor, rgba, 4) != 0;
+    if (issue) {
+        glVertexAttrib4Nubv(1, rgba);
+        memcpy(gl_state.VertexColor, rgba, 4);
+        gl_state.VertexColorValid = true;
+    }
+    stateCount(issue);
+}
+
+/* Constant values of the instance attributes for non-instanced draws */
+void stateInstanceDefaults ()
+{
+    bool issue = !gl_state.InstanceDefaults;
+    if (issue) {
+        glVertexAttrib4f(2, 0, 0, 0, 0);
+        glVertexAttrib4f(3, 1, 1, 1, 1);
+        gl_state.InstanceDefaults = true;
+    }
+    stateCount(issue, 2);
+}
+
+/* Deleting a bound object rebinds 0 behind the cache's back */
+void stateDeleted (GLuint vertex_array, GLuint buffer)
+{
+    if (vertex_array && gl_state.VertexArray == vertex_array)
+        gl_state.VertexArray = 0;
+    if (buffer && gl_state.ArrayBuffer == buffer)
+        gl_state.ArrayBuffer = 0;
+}
+
+/* Generate a VAO with one interleaved VBO. Positions are stored as 2 floats
+   when every z is 0 (the shader fills z back in), per-vertex colours as
+   RGBA8 right after them. Without color_buffer_data the VBO holds positions
+   only and the colour is a constant attribute set at draw time */
+struct VAO* createInterleavedObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode)
 {
     struct VAO* vao = new struct VAO;
+    vao->RefCount = 0;
+    vao->InstanceArrayID = 0;
+    vao->Radius = 0;
+    vao->Arc = 1;
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
+    vao->VertexColors = color_buffer_data != NULL;
+    packColor(vao->FlatColor, 1, 1, 1);
+
+    vao->PositionSize = 2;
+    for (int i=0; i<numVertices; i++)
+        if (vertex_buffer_data[3*i + 2] != 0)
+            vao->PositionSize = 3;
+    vao->Stride = vao->PositionSize*sizeof(GLfloat) + (vao->VertexColors ? 4 : 0);
+
+    vector<GLubyte> interleaved(numVertices*vao->Stride);
+    for (int i=0; i<numVertices; i++) {
+        GLubyte* vertex = &interleaved[i*vao->Stride];
+        memcpy(vertex, &vertex_buffer_data[3*i], vao->PositionSize*sizeof(GLfloat));
+        if (vao->VertexColors)
+            packColor(vertex + vao->PositionSize*sizeof(GLfloat), color_buffer_data[3*i], color_buffer_data[3*i + 1], color_buffer_data[3*i + 2]);
+    }
 
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
     glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
+    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - interleaved vertices
 
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+    stateBindVertexArray (vao->VertexArrayID); // Bind the VAO
+    stateBindArrayBuffer (vao->VertexBuffer); // Bind the VBO vertices
+    glBufferData (GL_ARRAY_BUFFER, interleaved.size(), &interleaved[0], GL_STATIC_DRAW); // Copy the vertices into VBO
     glVertexAttribPointer(
                           0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
+                          vao->PositionSize,  // size (x,y) or (x,y,z)
                           GL_FLOAT,           // type
                           GL_FALSE,           // normalized?
-                          0,                  // stride
+                          vao->Stride,        // stride
                           (void*)0            // array buffer offset
                           );
+    glEnableVertexAttribArray(0);
 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
+    if (vao->VertexColors) {
+        glVertexAttribPointer(
+                              1,                  // attribute 1. Color
+                              4,                  // size (r,g,b,a)
+                              GL_UNSIGNED_BYTE,   // type
+                              GL_TRUE,            // normalized?
+                              vao->Stride,        // stride
+                              (void*)(vao->PositionSize*sizeof(GLfloat)) // array buffer offset
+                              );
+        glEnableVertexAttribArray(1);
+    }
 
     return vao;
 }
 
+/* Generate VAO, VBOs and return VAO handle */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    return createInterleavedObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+}
+
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-    for (int i=0; i<numVertices; i++) {
-        color_buffer_data [3*i] = red;
-        color_buffer_data [3*i + 1] = green;
-        color_buffer_data [3*i + 2] = blue;
-    }
-
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    struct VAO* vao = createInterleavedObject(primitive_mode, numVertices, vertex_buffer_data, NULL, fill_mode);
+    packColor(vao->FlatColor, red, green, blue);
+    return vao;
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+/* Render the VBOs handled by VAO, in the given flat colour if it has no
+   per-vertex colours */
+void draw3DObject (struct VAO* vao, const GLubyte* flat_color)
 {
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    statePolygonMode (vao->FillMode);
 
     // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+    stateBindVertexArray (vao->VertexArrayID);
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    // Flat colour goes in as the constant value of attribute 1
+    if (!vao->VertexColors)
+        stateVertexColor(flat_color);
+    stateInstanceDefaults();
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    // Tell the fragment shader whether this quad is a circle
+    stateCircle(vao->Radius, vao->Arc);
 
     // Draw the geometry !
     glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+
+    // The current value of an attribute read from an array is undefined afterwards
+    if (vao->VertexColors)
+        gl_state.VertexColorValid = false;
+}
+
+/* Render the VBOs handled by VAO */
+void draw3DObject (struct VAO* vao)
+{
+    draw3DObject(vao, vao->FlatColor);
+}
+
+/* Render shared geometry in an object's own colour */
+void draw3DObject (struct VAO* vao, Color color)
+{
+    GLubyte rgba[4];
+    packColor(rgba, color.r, color.g, color.b);
+    draw3DObject(vao, rgba);
+}
+
+/* Ring buffer for data uploaded every frame. It is split into STREAM_FRAMES
+   regions so the CPU writes one region while the GPU still reads the others.
+   With GL_ARB_buffer_storage the buffer is mapped once (persistent, coherent)
+   and a fence per region tells when it may be rewritten; otherwise the buffer
+   is orphaned with glBufferData(NULL) each frame and filled by glBufferSubData */
+#define STREAM_FRAMES 3
+
+struct StreamBuffer {
+    GLuint Buffer;
+    GLsizeiptr RegionSize;
+    int Region;
+    GLsizeiptr Offset;
+    bool Persistent;
+    char* Mapped;
+    GLsync Fences[STREAM_FRAMES];
+
+    long FrameBytes, FrameFenceWaits;   // for the frame in progress
+    long LastBytes, LastFenceWaits;     // for the last frame finished
+    long TotalBytes, TotalFenceWaits;
+};
+typedef struct StreamBuffer StreamBuffer;
+
+StreamBuffer instance_stream;
+
+void allocateStreamBuffer (StreamBuffer& stream)
+{
+    glGenBuffers (1, &(stream.Buffer));
+    stateBindArrayBuffer (stream.Buffer);
+    if (stream.Persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage (GL_ARRAY_BUFFER, STREAM_FRAMES*stream.RegionSize, NULL, flags);
+        stream.Mapped = (char*) glMapBufferRange (GL_ARRAY_BUFFER, 0, STREAM_FRAMES*stream.RegionSize, flags);
+    }
+    else
+        glBufferData (GL_ARRAY_BUFFER, STREAM_FRAMES*stream.RegionSize, NULL, GL_STREAM_DRAW);
+    for (int i=0; i<STREAM_FRAMES; i++)
+        stream.Fences[i] = 0;
+}
+
+void createStreamBuffer (StreamBuffer& stream, GLsizeiptr region_size)
+{
+    stream.RegionSize = region_size;
+    stream.Region = 0;
+    stream.Offset = 0;
+    stream.Persistent = GLAD_GL_ARB_buffer_storage != 0;
+    stream.Mapped = NULL;
+    stream.FrameBytes = stream.FrameFenceWaits = 0;
+    stream.LastBytes = stream.LastFenceWaits = 0;
+    stream.TotalBytes = stream.TotalFenceWaits = 0;
+    allocateStreamBuffer(stream);
+}
+
+/* Move on to the next region, waiting for the GPU only if it is still
+   reading what was written there STREAM_FRAMES frames ago */
+void streamBeginFrame (StreamBuffer& stream)
+{
+    stream.Region = (stream.Region + 1) % STREAM_FRAMES;
+    stream.Offset = 0;
+    stream.FrameBytes = stream.FrameFenceWaits = 0;
+
+    if (!stream.Persistent) {
+        stateBindArrayBuffer (stream.Buffer);
+        glBufferData (GL_ARRAY_BUFFER, STREAM_FRAMES*stream.RegionSize, NULL, GL_STREAM_DRAW);
+        return;
+    }
+    GLsync fence = stream.Fences[stream.Region];
+    if (fence) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            stream.FrameFenceWaits++;
+            stream.TotalFenceWaits++;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+                ;
+        }
+        glDeleteSync(fence);
+        stream.Fences[stream.Region] = 0;
+    }
+}
+
+/* Fence the region written this frame and keep its counts, which also go
+   on the profile timeline */
+void streamEndFrame (StreamBuffer& stream)
+{
+    if (stream.Persistent)
+        stream.Fences[stream.Region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream.LastBytes = stream.FrameBytes;
+    stream.LastFenceWaits = stream.FrameFenceWaits;
+    uint64_t now = profile_now();
+    profile_counter("stream bytes", now, stream.FrameBytes);
+    profile_counter("stream fence waits", now, stream.FrameFenceWaits);
+}
+
+/* Copy data into the current region and return its offset in the buffer.
+   A region that overflows is replaced by one twice as large; draws already
+   issued keep reading the old buffer until the GPU is done with it */
+GLintptr streamWrite (StreamBuffer& stream, const void* data, GLsizeiptr size)
+{
+    if (stream.Offset + size > stream.RegionSize) {
+        if (stream.Persistent) {
+            stateBindArrayBuffer (stream.Buffer);
+            glUnmapBuffer (GL_ARRAY_BUFFER);
+            for (int i=0; i<STREAM_FRAMES; i++)
+                if (stream.Fences[i])
+                    glDeleteSync(stream.Fences[i]);
+        }
+        glDeleteBuffers (1, &(stream.Buffer));
+        stateDeleted(0, stream.Buffer);
+        while (stream.RegionSize < size)
+            stream.RegionSize *= 2;
+        stream.RegionSize *= 2;
+        allocateStreamBuffer(stream);
+        stream.Offset = 0;
+    }
+
+    GLintptr offset = stream.Region*stream.RegionSize + stream.Offset;
+    if (stream.Persistent)
+        memcpy(stream.Mapped + offset, data, size);
+    else {
+        stateBindArrayBuffer (stream.Buffer);
+        glBufferSubData (GL_ARRAY_BUFFER, offset, size, data);
+    }
+    // Keep every upload aligned for the attribute pointers that read it
+    stream.Offset += (size + 15) & ~(GLsizeiptr)15;
+    stream.FrameBytes += size;
+    stream.TotalBytes += size;
+    return offset;
+}
+
+/* Per-instance attributes, read by the shader with divisor 1 */
+struct InstanceData {
+    GLfloat x, y, z;
+    GLfloat angle;      // radians
+    GLubyte color[4];   // normalized RGBA8
+};
+typedef struct InstanceData InstanceData;
+
+/* VAO that reads the geometry's VBO per vertex, made the first time the
+   geometry is drawn instanced. The instance attributes are pointed into
+   instance_stream at draw time */
+GLuint instanceArray (VAO* geometry)
+{
+    if (geometry->InstanceArrayID != 0)
+        return geometry->InstanceArrayID;
+
+    glGenVertexArrays(1, &(geometry->InstanceArrayID));
+
+    stateBindVertexArray (geometry->InstanceArrayID);
+    stateBindArrayBuffer (geometry->VertexBuffer);
+    glVertexAttribPointer(0, geometry->PositionSize, GL_FLOAT, GL_FALSE, geometry->Stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    if (geometry->VertexColors) {
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, geometry->Stride, (void*)(geometry->PositionSize*sizeof(GLfloat)));
+        glEnableVertexAttribArray(1);
+    }
+    glVertexAttribDivisor(2, 1);
+    glVertexAttribDivisor(3, 1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    return geometry->InstanceArrayID;
+}
+
+/* Upload the instances and draw them all in one call. MVP must hold just
+   the view-projection, the per-instance transform is applied in the shader */
+void drawInstances (VAO* geometry, const InstanceData* instances, int count)
+{
+    GLintptr offset = streamWrite(instance_stream, instances, count*sizeof(InstanceData));
+
+    statePolygonMode (geometry->FillMode);
+    stateCircle(geometry->Radius, geometry->Arc);
+    stateBindVertexArray (instanceArray(geometry));
+    stateBindArrayBuffer (instance_stream.Buffer);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offset);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, color)));
+    if (!geometry->VertexColors)
+        stateVertexColor(geometry->FlatColor);
+    glDrawArraysInstanced(geometry->PrimitiveMode, 0, geometry->NumVertices, count);
+    gl_state.InstanceDefaults = false;
+    if (geometry->VertexColors)
+        gl_state.VertexColorValid = false;
+}
+
+/* draw() submits the scene in passes, one per kind of object. The render
+   queue keeps the pass in each item's key, so a pass can be timed on the GPU
+   even though the queue draws everything in one flush */
+enum RenderPass {
+    PASS_GUNS,
+    PASS_BRICKS,
+    PASS_LINE,
+    PASS_BASKETS,
+    PASS_MIRRORS,
+    PASS_LASERS,
+    RENDER_PASSES
+};
+
+const char* render_pass_names[RENDER_PASSES] = { "guns", "bricks", "line", "baskets", "mirrors", "lasers" };
+const char* gpu_counter_names[RENDER_PASSES] = { "gpu guns (ms)", "gpu bricks (ms)", "gpu line (ms)", "gpu baskets (ms)", "gpu mirrors (ms)", "gpu lasers (ms)" };
+
+/* GL_TIME_ELAPSED queries around each stretch of draws that belongs to one
+   pass. A frame's queries are read GPU_TIMER_FRAMES frames later, when the
+   GPU is long done with them, so reading them never stalls; should they
+   still be pending the frame in between goes untimed instead of waiting */
+#define GPU_TIMER_FRAMES 4
+// A pass can be split over layers, so allow a few queries per pass
+#define GPU_TIMER_QUERIES (4*RENDER_PASSES)
+
+struct GpuTimerFrame {
+    GLuint Queries[GPU_TIMER_QUERIES];
+    int Pass[GPU_TIMER_QUERIES];
+    int Count;              // queries issued
+    bool Full;              // passes went untimed once the queries ran out
+    uint64_t CpuTime;       // profile_now() when the frame was drawn
+};
+typedef struct GpuTimerFrame GpuTimerFrame;
+
+struct GpuTimers {
+    bool Enabled;
+    GpuTimerFrame Frames[GPU_TIMER_FRAMES];
+    int Frame;
+    int Active;             // pass of the open query, -1 for none
+    bool Skip;              // this frame goes untimed
+
+    double TotalMs[RENDER_PASSES];
+    long FramesTimed, FramesSkipped;
+    long FramesFull;        // left out of the averages, which they would drag down
+};
+typedef struct GpuTimers GpuTimers;
+
+GpuTimers gpu_timers;
+
+void createGpuTimers (GpuTimers& timers)
+{
+    timers.Enabled = GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query;
+    timers.Frame = 0;
+    timers.Active = -1;
+    timers.Skip = false;
+    for (int p=0; p<RENDER_PASSES; p++)
+        timers.TotalMs[p] = 0;
+    timers.FramesTimed = timers.FramesSkipped = timers.FramesFull = 0;
+    for (int f=0; f<GPU_TIMER_FRAMES; f++) {
+        timers.Frames[f].Count = 0;
+        timers.Frames[f].Full = false;
+        if (timers.Enabled)
+            glGenQueries(GPU_TIMER_QUERIES, timers.Frames[f].Queries);
+    }
+}
+
+/* Collect the results of the frame drawn GPU_TIMER_FRAMES ago and start
+   timing a new one in its place */
+void gpuTimersBeginFrame (GpuTimers& timers)
+{
+    if (!timers.Enabled)
+        return;
+    timers.Frame = (timers.Frame + 1) % GPU_TIMER_FRAMES;
+    GpuTimerFrame& frame = timers.Frames[timers.Frame];
+    timers.Active = -1;
+    timers.Skip = false;
+    if (frame.Full)
+        timers.FramesFull++;
+    else if (frame.Count > 0) {
+        // Queries finish in order, so the last one being done means all are
+        GLint available = 0;
+        glGetQueryObjectiv(frame.Queries[frame.Count-1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            timers.Skip = true;
+            timers.FramesSkipped++;
+            return;
+        }
+        double ms[RENDER_PASSES] = {0};
+        for (int q=0; q<frame.Count; q++) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(frame.Queries[q], GL_QUERY_RESULT, &elapsed);
+            ms[frame.Pass[q]] += elapsed/1e6;
+        }
+        for (int p=0; p<RENDER_PASSES; p++) {
+            timers.TotalMs[p] += ms[p];
+            profile_counter(gpu_counter_names[p], frame.CpuTime, ms[p]);
+        }
+        timers.FramesTimed++;
+    }
+    frame.Count = 0;
+    frame.Full = false;
+    frame.CpuTime = profile_now();
+}
+
+/* The draws that follow belong to pass */
+void gpuTimerPass (GpuTimers& timers, int pass)
+{
+    if (!timers.Enabled || timers.Skip || timers.Active == pass)
+        return;
+    GpuTimerFrame& frame = timers.Frames[timers.Frame];
+    if (timers.Active != -1)
+        glEndQuery(GL_TIME_ELAPSED);
+    timers.Active = -1;
+    if (frame.Count == GPU_TIMER_QUERIES) {
+        frame.Full = true;
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, frame.Queries[frame.Count]);
+    frame.Pass[frame.Count++] = pass;
+    timers.Active = pass;
+}
+
+void gpuTimersEndFrame (GpuTimers& timers)
+{
+    if (timers.Active != -1)
+        glEndQuery(GL_TIME_ELAPSED);
+    timers.Active = -1;
+}
+
+/* Everything draw() renders is submitted to a render queue. Each item gets
+   a 64-bit key packed from its layer, program, VAO and fill mode, and the
+   queue is radix sorted on it before anything reaches GL. Runs of equal keys
+   share all their state, and a run on a plain instance transform becomes
+   one instanced draw. The sort is stable, so equal keys keep submit order */
+enum RenderLayer {
+    LAYER_BACKGROUND,   // falling bricks, painted over by the scene
+    LAYER_SCENE,
+    LAYER_OVERLAY,      // details drawn on top of scene objects at the same depth
+    LAYER_PROJECTILES   // lasers, behind everything at z = -1
+};
+
+#define RENDER_KEY_LAYER_SHIFT 56
+#define RENDER_KEY_PROGRAM_SHIFT 48
+#define RENDER_KEY_VAO_SHIFT 24
+#define RENDER_KEY_FILL_SHIFT 22
+#define RENDER_KEY_MODEL_SHIFT 21  // set for items with a full model matrix
+/* Lowest, so passes only split runs that would otherwise merge. Passes are
+   numbered in submit order, which the stable sort kept for those anyway */
+#define RENDER_KEY_PASS_SHIFT 16
+
+struct RenderItem {
+    VAO* geometry;
+    InstanceData instance;
+    int model;          // index into RenderQueue.models, -1 for the instance transform
+};
+typedef struct RenderItem RenderItem;
+
+struct RenderQueue {
+    vector<uint64_t> keys;
+    vector<RenderItem> items;
+    vector<glm::mat4> models;
+    vector<uint32_t> order, scratch;    // item indices, sorted by key
+    vector<InstanceData> run;           // instances of the run being drawn
+    int Pass;                           // pass the next submits belong to
+
+    long FrameItems, FrameDraws;        // for the last flushed frame
+    long TotalItems, TotalDraws;
+};
+typedef struct RenderQueue RenderQueue;
+
+RenderQueue render_queue;
+
+uint64_t renderKey (int layer, GLuint program, VAO* geometry, bool model, int pass)
+{
+    uint64_t fill = geometry->FillMode == GL_FILL ? 0 : geometry->FillMode == GL_LINE ? 1 : 2;
+    return ((uint64_t)(layer & 0xff) << RENDER_KEY_LAYER_SHIFT)
+         | ((uint64_t)(program & 0xff) << RENDER_KEY_PROGRAM_SHIFT)
+         | ((uint64_t)(geometry->VertexArrayID & 0xffffff) << RENDER_KEY_VAO_SHIFT)
+         | (fill << RENDER_KEY_FILL_SHIFT)
+         | ((uint64_t)model << RENDER_KEY_MODEL_SHIFT)
+         | ((uint64_t)(pass & 0x1f) << RENDER_KEY_PASS_SHIFT);
+}
+
+void renderPass (RenderQueue& queue, int pass)
+{
+    queue.Pass = pass;
+}
+
+void renderPush (RenderQueue& queue, uint64_t key, VAO* geometry, float x, float y, float z, float angle, Color color, int model)
+{
+    RenderItem item;
+    item.geometry = geometry;
+    item.instance.x = x;
+    item.instance.y = y;
+    item.instance.z = z;
+    item.instance.angle = angle*M_PI/180.0f;
+    packColor(item.instance.color, color.r, color.g, color.b);
+    item.model = model;
+
+    // Hold the geometry until the flush; the object may be released before it
+    geometry_retain(geometry);
+    queue.keys.push_back(key);
+    queue.items.push_back(item);
+}
+
+/* Queue one object translated to (x,y,z) and rotated by angle degrees about z */
+void renderSubmit (RenderQueue& queue, int layer, VAO* geometry, float x, float y, float z, float angle, Color color)
+{
+    renderPush(queue, renderKey(layer, programID, geometry, false, queue.Pass), geometry, x, y, z, angle, color, -1);
+}
+
+/* Queue one object with an arbitrary model matrix; it is drawn on its own */
+void renderSubmit (RenderQueue& queue, int layer, VAO* geometry, const glm::mat4& model, Color color)
+{
+    queue.models.push_back(model);
+    renderPush(queue, renderKey(layer, programID, geometry, true, queue.Pass), geometry, 0, 0, 0, 0, color, queue.models.size() - 1);
+}
+
+/* LSD radix sort of the item indices, one byte of the key per pass.
+   Bytes that are equal in every key are skipped */
+void renderQueueSort (RenderQueue& queue)
+{
+    int n = queue.items.size();
+    queue.order.resize(n);
+    queue.scratch.resize(n);
+    for (int i=0; i<n; i++)
+        queue.order[i] = i;
+    if (n < 2)
+        return;
+
+    const uint64_t* keys = &queue.keys[0];
+    for (int shift=0; shift<64; shift+=8) {
+        int start[257] = {0};
+        for (int i=0; i<n; i++)
+            start[((keys[i] >> shift) & 0xff) + 1]++;
+        if (start[((keys[0] >> shift) & 0xff) + 1] == n)
+            continue;
+        for (int b=0; b<256; b++)
+            start[b+1] += start[b];
+        for (int i=0; i<n; i++) {
+            uint32_t item = queue.order[i];
+            queue.scratch[start[(keys[item] >> shift) & 0xff]++] = item;
+        }
+        queue.order.swap(queue.scratch);
+    }
+}
+
+/* Sort and draw everything queued this frame, then empty the queue */
+void renderQueueFlush (RenderQueue& queue, const glm::mat4& VP)
+{
+    renderQueueSort(queue);
+
+    int n = queue.items.size();
+    bool vp_loaded = false;
+    queue.FrameItems = n;
+    queue.FrameDraws = 0;
+    for (int i=0; i<n; ) {
+        uint64_t key = queue.keys[queue.order[i]];
+        RenderItem& first = queue.items[queue.order[i]];
+        gpuTimerPass(gpu_timers, (key >> RENDER_KEY_PASS_SHIFT) & 0x1f);
+
+        if (first.model >= 0) {
+            glm::mat4 MVP = VP * queue.models[first.model];
+            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+            vp_loaded = false;
+            draw3DObject(first.geometry, first.instance.color);
+            queue.FrameDraws++;
+            i++;
+            continue;
+        }
+
+        queue.run.clear();
+        for (; i<n && queue.keys[queue.order[i]] == key; i++)
+            queue.run.push_back(queue.items[queue.order[i]].instance);
+        if (!vp_loaded) {
+            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &VP[0][0]);
+            vp_loaded = true;
+        }
+        drawInstances(first.geometry, &queue.run[0], queue.run.size());
+        queue.FrameDraws++;
+    }
+
+    queue.TotalItems += queue.FrameItems;
+    queue.TotalDraws += queue.FrameDraws;
+    gpuTimersEndFrame(gpu_timers);
+    for (int i=0; i<n; i++)
+        geometry_release(queue.items[i].geometry);
+    queue.keys.clear();
+    queue.items.clear();
+    queue.models.clear();
+}
+
+/* With --profile FILE the phase timings are written to FILE on P and at exit.
+   Both run on the main thread between ticks, when the job workers are idle */
+const char* profile_path = NULL;
+
+void writeProfile ()
+{
+    if (!profile_path)
+        return;
+    if (profile_write_trace(profile_path))
+        cerr << "profile: trace written to " << profile_path << endl;
+    else
+        cerr << profile_path << ": cannot write profile" << endl;
 }
 
 /**************************
@@ -361,6 +1018,9 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 				if(brick_speed>0.03)
 					brick_speed-=0.02;
 				break;
+			case GLFW_KEY_P:
+				writeProfile();
+				break;
 			case GLFW_KEY_UP:
 				if(zoom<3){
 					zoom++;
@@ -467,12 +1127,7 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 				float anglee= (atan(slope)*180.0)/M_PI;
 				if(anglee>=-60 && anglee<=60){
 					gun_rotation = anglee;
-					string laser = "laser" + to_string(laser_count);
-					if(Laser[laser].status == 0){
-						Laser[laser].angle = anglee;
-						Laser[laser].status = 1;
-						click_time=glfwGetTime();
-					}
+					fireLaser(anglee);
 					// createRectangle(laser,"Laser",red,0.15,0.04,-3.6,gun_translation,anglee);
 					// laser_count++;
 				}
@@ -500,14 +1155,123 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	Matrices.projection = glm::ortho(-4.0f+zoom-pan, 4.0f-zoom-pan, -4.0f+zoom, 4.0f-zoom, 0.1f, 500.0f);
 }
 
+/* Input events reach the game through these wrappers, which stamp them with
+   the tick they are applied before and record them with --record. While a
+   --replay runs, the log drives the game and live input is ignored */
+InputLog input_record;
+bool recording = false;
+bool replaying = false;
+vector<InputEvent> replay_events;
+size_t replay_next = 0;
+long replay_end_tick = 0;
+GLFWwindow* replay_window = NULL;     // NULL when replaying headless
+
+void recordEvent (int type, int code, int action, int mods, double x, double y)
+{
+    if (!recording)
+        return;
+    InputEvent event = { sim_ticks, type, code, action, mods, x, y };
+    inputLogWrite(input_record, event);
+}
+
+void inputKey (GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (replaying)
+        return;
+    recordEvent(INPUT_KEY, key, action, mods, 0, 0);
+    keyboard(window, key, scancode, action, mods);
+}
+
+void inputMouseButton (GLFWwindow* window, int button, int action, int mods)
+{
+    if (replaying)
+        return;
+    recordEvent(INPUT_MOUSE_BUTTON, button, action, mods, 0, 0);
+    mouseButton(window, button, action, mods);
+}
+
+void inputCursor (GLFWwindow* window, double xpos, double ypos)
+{
+    if (replaying)
+        return;
+    recordEvent(INPUT_CURSOR, 0, 0, 0, xpos, ypos);
+    cursor_position(window, xpos, ypos);
+}
+
+void inputScroll (GLFWwindow* window, double xoffset, double yoffset)
+{
+    if (replaying)
+        return;
+    recordEvent(INPUT_SCROLL, 0, 0, 0, xoffset, yoffset);
+    scroll_callback(window, xoffset, yoffset);
+}
+
+/* Write the end marker and close the log being recorded */
+void finishRecording ()
+{
+    inputLogClose(input_record, sim_ticks);
+}
+
+/* Load a log to replay; the game is seeded from it */
+bool startReplay (const char* path, uint64_t& seed)
+{
+    if (!inputLogLoad(path, seed, replay_events))
+        return false;
+    replaying = true;
+    replay_next = 0;
+    // Without an INPUT_END the session stopped after its last event
+    replay_end_tick = replay_events.empty() ? 0 : replay_events.back().tick;
+    return true;
+}
+
+/* Feed the game every logged event stamped at or before this tick */
+void replayEvents (long tick)
+{
+    while (replay_next < replay_events.size() && replay_events[replay_next].tick <= tick) {
+        const InputEvent& event = replay_events[replay_next++];
+        switch (event.type) {
+            case INPUT_KEY:
+                keyboard(replay_window, event.code, 0, event.action, event.mods);
+                break;
+            case INPUT_MOUSE_BUTTON:
+                mouseButton(replay_window, event.code, event.action, event.mods);
+                break;
+            case INPUT_CURSOR:
+                cursor_position(replay_window, event.x, event.y);
+                break;
+            case INPUT_SCROLL:
+                scroll_callback(replay_window, event.x, event.y);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* Run one tick, replaying the input logged for it first */
+void step ()
+{
+    if (replaying)
+        replayEvents(sim_ticks);
+    tick();
+}
+
+bool replayFinished ()
+{
+    return replaying && sim_ticks >= replay_end_tick;
+}
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
 {
     int fbwidth=width, fbheight=height;
     /* With Retina display on Mac OS X, GLFW's FramebufferSize
-     is different from WindowSize */
-    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+     is different from WindowSize. Offscreen there is no window and the
+     surface is exactly width x height */
+    if (window) {
+        glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    }
 
 	GLfloat fov = 90.0f;
 
@@ -550,187 +1314,143 @@ VAO *triangle, *circle, *rectangle;
 //   triangle = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_LINE);
 // }
 
-// Creates the rectangle object used in this sample code
-void createRectangle (string comp, string body, Color Color, float l, float b, float x, float y,float angle)
-{
-	const GLfloat vertex_buffer_data [] = {
-		-l,-b,0,
-		l,-b,0,
-		l,b,0,
-
-		l,b,0,
-		-l,b,0,
-		-l,-b,0
-	};
-
-	const GLfloat color_buffer_data [] = {
-	  Color.r,Color.g,Color.b, // color 1
-	  Color.r,Color.g,Color.b, // color 2
-	  Color.r,Color.g,Color.b, // color 3
-
-	  Color.r,Color.g,Color.b, // color 3
-	  Color.r,Color.g,Color.b, // color 4
-	  Color.r,Color.g,Color.b  // color 1
-	};
-
-	rectangle = create3DObject(GL_TRIANGLES,6,vertex_buffer_data, color_buffer_data, GL_FILL);
-
-	gameObjects gameObject = {};
-	gameObject.name = comp;
-	gameObject.object = rectangle;
-	gameObject.x = x;
-	gameObject.y = y;
-	gameObject.len = 2*l;
-	gameObject.breadth = 2*b;
-	gameObject.speed = 0;
-	gameObject.color =  Color;
-	gameObject.angle = angle;
-
-	if(body == "Basket")
-		Basket[comp] = gameObject;
-	else if(body == "Brick")
-		Brick[comp] = gameObject;
-	else if(body == "Gun")
-		Gun[comp] = gameObject;
-	else if(body == "Laser"){
-		gameObject.speed = 0.11;
-		Laser[comp] = gameObject;
-	}
-	else if(body == "Mirror")
-		Mirror[comp] = gameObject;
-	else if(body== "Line")
-		Line[comp] = gameObject;
-
-}
-
-void createCircle (string comp, string body, Color Color, float radius, float x, float y,float parts)
-{
-	GLfloat vertex_buffer_data[360*9];
-	GLfloat color_buffer_data[360*9];
-	for(int i=0;i<360;i++){
-		vertex_buffer_data[9*i]=0;
-		vertex_buffer_data[9*i+1]=0;
-		vertex_buffer_data[9*i+2]=0;
-		vertex_buffer_data[9*i+3]=radius*cos(i*M_PI/180);
-		vertex_buffer_data[9*i+4]=radius*sin(i*M_PI/180);
-		vertex_buffer_data[9*i+5]=0;
-		vertex_buffer_data[9*i+6]=radius*cos((i+1)*M_PI/180);
-		vertex_buffer_data[9*i+7]=radius*sin((i+1)*M_PI/180);
-		vertex_buffer_data[9*i+8]=0;
+/* Shared geometry, keyed on shape parameters only; colour is supplied
+   per draw as a constant or per-instance attribute */
+enum GeometryShape { GEOMETRY_RECTANGLE, GEOMETRY_CIRCLE };
+
+struct GeometryKey {
+	int shape;
+	float a, b;   // half length/breadth, or radius/arc fraction
+};
+typedef struct GeometryKey GeometryKey;
+
+bool operator< (const GeometryKey& p, const GeometryKey& q)
+{
+	if(p.shape != q.shape) return p.shape < q.shape;
+	if(p.a != q.a) return p.a < q.a;
+	return p.b < q.b;
+}
+
+// Unreferenced entries stay resident so respawning a shape is free;
+// they are only deleted once more than this many pile up
+#define GEOMETRY_CACHE_IDLE_LIMIT 16
+
+map <GeometryKey,VAO*> geometry_cache;
+int geometry_cache_hits = 0, geometry_cache_misses = 0, geometry_cache_idle = 0;
+
+/* Look up a cached VAO and take a reference to it. Returns NULL on a miss */
+VAO* geometry_acquire (GeometryKey key)
+{
+	map<GeometryKey,VAO*>::iterator it = geometry_cache.find(key);
+	if(it == geometry_cache.end()){
+		geometry_cache_misses++;
+		return NULL;
 	}
-	for (int i = 0; i<360*9; i+=3){
-		color_buffer_data[i]=Color.r;
-		color_buffer_data[i+1]=Color.g;
-		color_buffer_data[i+2]=Color.b;
+	geometry_cache_hits++;
+	if(it->second->RefCount++ == 0)
+		geometry_cache_idle--;
+	return it->second;
+}
+
+/* Add a freshly built VAO to the cache, already holding one reference */
+VAO* geometry_insert (GeometryKey key, VAO* vao)
+{
+	vao->RefCount = 1;
+	geometry_cache[key] = vao;
+	return vao;
+}
+
+/* Delete the GL objects of every unreferenced cache entry */
+void geometry_cache_trim ()
+{
+	map<GeometryKey,VAO*>::iterator it = geometry_cache.begin();
+	while(it != geometry_cache.end()){
+		VAO* vao = it->second;
+		if(vao->RefCount == 0){
+			glDeleteBuffers(1, &vao->VertexBuffer);
+			glDeleteVertexArrays(1, &vao->VertexArrayID);
+			stateDeleted(vao->VertexArrayID, vao->VertexBuffer);
+			if(vao->InstanceArrayID){
+				glDeleteVertexArrays(1, &vao->InstanceArrayID);
+				stateDeleted(vao->InstanceArrayID, 0);
+			}
+			delete vao;
+			geometry_cache.erase(it++);
+		}
+		else
+			it++;
 	}
-	circle = create3DObject(GL_TRIANGLES, (360*3)*parts, vertex_buffer_data, color_buffer_data, GL_FILL);
-
-	gameObjects gameObject = {};
-	gameObject.name = comp;
-	gameObject.object = circle;
-	gameObject.x = x;
-	gameObject.y = y;
-	gameObject.radius = radius;
-	gameObject.speed = 0;
-	gameObject.color =  Color;
-	if(body == "Gun")
-		Gun[comp] = gameObject;
-	else if (body == "Basket")
-		Basket[comp] = gameObject;
-}
-
-void brickdraw ()
-{
-	Color black = {0,0,0};
-	Color green = {0,1,0};
-	Color red = {1,0,0};
-	map<int,Color> colormap;
-	colormap[0] = black;
-	colormap[1] = red;
-	colormap[2] = green;
-	string brick = "brick" +  to_string (brick_cnt);
-	float x = ((float)rand()/(float)RAND_MAX)*5-2.5;
-	int clr = rand()%3;
-	createRectangle(brick,"Brick",colormap[clr],0.08,0.18,x,4.0,0);
-	brick_cnt++;
-}
-
-int intersect_point(Point p1,Point p2,Point p4,Point p5){
-  float x0=p1.x, y0=p1.y,x1=p2.x, y1=p2.y;int i;
-// Point p3;
-
-    float s1_x, s1_y, s2_x, s2_y, x2=p4.x, y2=p4.y, x3=p5.x, y3=p5.y, q, p, r;
-
-    s1_x = x1 - x0;  current_time = glfwGetTime(); // Time in seconds
-  if ((current_time - last_update_time) >= 2.0) { // atleast 0.5s elapsed since last frame
-	  brickdraw();
-	  last_update_time = current_time;
-  }
-    s1_y = y1 - y0;
-    s2_x = x3 - x2;
-    s2_y = y3 - y2;
-
-    r=s1_x*s2_y - s2_x*s1_y;
-    if(r==0){
-      // p3.va=0;
-      return 0;
-    }
+	geometry_cache_idle = 0;
+}
 
-    p = (s1_x*(y0-y2) - s1_y*(x0-x2))/(r*1.0f);
-    q = (s2_x*(y0-y2) - s2_y*(x0-x2))/(r*1.0f);
+/* Take another reference to a VAO already held */
+void geometry_retain (struct VAO* vao)
+{
+	if(vao->RefCount++ == 0)
+		geometry_cache_idle--;
+}
 
-    if (p>=0 && p<=1 && q>=0 && q<=1)
-    {
-        x_intersection = x0 + (q * s1_x);
-        y_intersection = y0 + (q * s1_y);
-        // p3.va=1;
-        return 1;
-    }
-    // p3.va=0;
-    return 0;
+/* Drop one reference taken by geometry_acquire, geometry_insert or geometry_retain */
+void geometry_release (struct VAO* vao)
+{
+	if(vao == NULL)
+		return;
+	if(--vao->RefCount == 0 && ++geometry_cache_idle > GEOMETRY_CACHE_IDLE_LIMIT)
+		geometry_cache_trim();
 }
 
-bool checkintersection (float x1 , float y1,float x2, float y2, float x3, float y3, float x4 , float y4)
+// Creates the rectangle object used in this sample code
+/* Shared quad of half-size l x b, drawn in whatever colour its user passes */
+VAO* rectangleGeometry (float l, float b)
 {
-  bool statement = ( (
-                        ((y3-y1)*(x2-x1)-(y2-y1)*(x3-x1))*
-                        ((y4-y1)*(x2-x1)-(y2-y1)*(x4-x1)) < 0
-                     ) &&
-                     (
-                       ((y1-y3)*(x4-x3)-(y4-y3)*(x1-x3))*
-                       ((y2-y3)*(x4-x3)-(y4-y3)*(x2-x3)) < 0
-                     )
-                   );
-  if (statement)
-  {
-    return true;
-  }
-  else
-  {
-    return false;
-  }
+	if(headless)
+		return NULL;
+
+	GeometryKey key = { GEOMETRY_RECTANGLE, l, b };
+	VAO* rectangle = geometry_acquire(key);
+	if(rectangle == NULL){
+		GLfloat vertex_buffer_data [GEOMETRY_VERTEX_FLOATS];
+		rectangleVertices(l, b, vertex_buffer_data);
+		rectangle = geometry_insert(key, create3DObject(GL_TRIANGLES,6,vertex_buffer_data, 1,1,1, GL_FILL));
+	}
+	return rectangle;
 }
 
-bool brick_coll_basket (string baskt, string brck)
+/* Shared quad around a circle of the given radius; the fragment shader cuts
+   out the disc, or the first parts fraction of it */
+VAO* circleGeometry (float radius, float parts)
 {
-	// cout << Basket[baskt].x << endl
-	if(Brick[brck].y<=-2.4 && Brick[brck].y>=-2.5 ){
-	if( Brick[brck].x >= Basket[baskt].x-(Basket[baskt].len/2 - Brick[brck].len/2) && Brick[brck].x <= Basket[baskt].x+(Basket[baskt].len/2 - Brick[brck].len/2))
-		return true;}
-	else
-		return false;
+	if(headless)
+		return NULL;
+
+	GeometryKey key = { GEOMETRY_CIRCLE, radius, parts };
+	VAO* circle = geometry_acquire(key);
+	if(circle == NULL){
+		// One quad around the circle, the fragment shader cuts out the disc
+		GLfloat vertex_buffer_data [GEOMETRY_VERTEX_FLOATS];
+		circleVertices(radius, vertex_buffer_data);
+		circle = geometry_insert(key, create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 1,1,1, GL_FILL));
+		circle->Radius = radius;
+		circle->Arc = parts;
+	}
+
+	return circle;
 }
 
-/* Render the scene with openGL */
+/* Render the scene with openGL, alpha of the way from the previous tick to the last one */
 /* Edit this function according to your assignment */
-void draw ()
+void draw (float alpha)
 {
+  PROFILE_SCOPE("draw");
   // clear the color and depth in the frame buffer
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // use the loaded shader program
   // Don't change unless you know what you are doing
-  glUseProgram (programID);
+  stateBeginFrame();
+  stateUseProgram (programID);
+  streamBeginFrame(instance_stream);
+  gpuTimersBeginFrame(gpu_timers);
 
   // Eye - Location of camera. Don't change unless you are sure!!
   glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
@@ -772,220 +1492,72 @@ void draw ()
 
   // Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
   // glPopMatrix ();
-  current_time = glfwGetTime(); // Time in seconds
-  if ((current_time - last_update_time) >= 2.0) { // atleast 0.5s elapsed since last frame
-	  brickdraw();
-	  last_update_time = current_time;
-  }
-
-  map<string, gameObjects>::iterator it,xy;
-  for(it=Gun.begin();it!=Gun.end();it++) //Gun construction
   {
-	  string current = it->first;
-	  Gun[current].y = gun_translation;
-	  glm::mat4 MVP;
-	  Matrices.model = glm::mat4(1.0f);
-	  glm::mat4 translateGun = glm::translate (glm::vec3(Gun[current].x, Gun[current].y, 0.0f));
-	  glm::mat4 prodGun = translateGun;
-	  if(current != "gun1"){
-	  	glm::mat4 rotateGun = glm::rotate((float)(gun_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-		prodGun *= rotateGun;
-	  }
-	  Matrices.model *= prodGun;
-	  MVP = VP * Matrices.model;
-	  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-	  draw3DObject(Gun[current].object);
-  }
-
-  for(it=Brick.begin();it!=Brick.end();it++)
-  {
-  	  string current = it->first;
-	  if(Brick[current].flag == -1)
-	  	continue;
-	  if(Brick[current].y <= -4.18){
-	  	points-=2;
-		Brick[current].flag = -1;
+	  PROFILE_SCOPE("draw guns");
+	  renderPass(render_queue, PASS_GUNS);
+	  for(int i=0;i<Gun.count;i++) //Gun construction
+	  {
+		  int layer = (i == gun_hub.index) ? LAYER_OVERLAY : LAYER_SCENE;
+		  renderSubmit(render_queue, layer, Gun.object[i], lerp(Gun.prev_x[i], Gun.x[i], alpha), lerp(Gun.prev_y[i], Gun.y[i], alpha), 0.0f, lerp(Gun.prev_angle[i], Gun.angle[i], alpha), Gun.color[i]);
 	  }
-	  glm::mat4 MVP;
-	  Matrices.model = glm::mat4(1.0f);
-	  glm::mat4 translateBrick = glm::translate (glm::vec3(Brick[current].x, Brick[current].y, 0.0f));
-	  Matrices.model *= (translateBrick);
-	  MVP = VP * Matrices.model;
-	  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	  draw3DObject(Brick[current].object);
-
   }
 
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateLine = glm::translate (glm::vec3(Line["line"].x, Line["line"].y, 0.0f));
-  Matrices.model *= (translateLine);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(Line["line"].object);
-
-  for(it=Basket.begin();it!=Basket.end();it++)
   {
-	  string current = it->first;
-	  Basket[current].x = laser_translation;
-	  if(current == "redbasket" || current == "redcircle")
-	  	Basket[current].x = red_basket_translation;
-	  else if((current == "greenbasket") || current == "greencircle")
-	  	Basket[current].x = green_basket_translation;
-	  glm::mat4 MVP;
-	  Matrices.model = glm::mat4(1.0f);
-	  glm::mat4 translateBasket = glm::translate (glm::vec3(Basket[current].x, Basket[current].y, 0.0f));
-	  glm::mat4 prodBasket = translateBasket;
-	  if(current == "redcircle" || current == "greencircle"){
-		glm::mat4 rotateBasket = glm::rotate((float)(70*M_PI/180.0f), glm::vec3(1,0,0));
-		prodBasket *= rotateBasket;
+	  PROFILE_SCOPE("draw bricks");
+	  renderPass(render_queue, PASS_BRICKS);
+	  for(int i=0;i<Brick.count;i++)
+	  {
+		  if(Brick.flag[i] == -1)
+		  	continue;
+		  renderSubmit(render_queue, LAYER_BACKGROUND, Brick.object[i], lerp(Brick.prev_x[i], Brick.x[i], alpha), lerp(Brick.prev_y[i], Brick.y[i], alpha), 0.0f, 0, Brick.color[i]);
 	  }
-	  Matrices.model *= (prodBasket);
-	  MVP = VP * Matrices.model;
-	  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-	  draw3DObject(Basket[current].object);
   }
 
-  for(it=Mirror.begin();it!=Mirror.end();it++)
   {
-	  string current = it->first;
-	  glm::mat4 MVP;
-	  Matrices.model = glm::mat4(1.0f);
-	  glm::mat4 translateMirror = glm::translate (glm::vec3(Mirror[current].x, Mirror[current].y, 0.0f));
-	  glm::mat4 rotateMirror = glm::rotate((float)(Mirror[current].angle*M_PI/180.0f), glm::vec3(0,0,1));
-	  Matrices.model *= (translateMirror*rotateMirror);
-	  MVP = VP * Matrices.model;
-	  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-	  draw3DObject(Mirror[current].object);
+	  PROFILE_SCOPE("draw line");
+	  renderPass(render_queue, PASS_LINE);
+	  renderSubmit(render_queue, LAYER_SCENE, Line.object[divider_line.index], Line.x[divider_line.index], Line.y[divider_line.index], 0.0f, 0, Line.color[divider_line.index]);
   }
 
-  for(it=Laser.begin();it!=Laser.end();it++)
   {
-	 string current = it->first;
-	//  cout << current << endl;
-	 if (Laser[current].flag == -1)
-	 	continue;
-	 if (Laser[current].status == 0){
-	 	Laser[current].status = laser_trans_status;
-	 	Laser[current].y = gun_translation;
-		click_time = glfwGetTime();
-	}
-	 glm::mat4 MVP;
-	 Matrices.model = glm::mat4(1.0f);
-	 glm::mat4 translateLaser = glm::translate (glm::vec3(Laser[current].x, Laser[current].y, -1.0f));
-	 glm::mat4 prodLaser = translateLaser;
-	 if(Laser[current].status == 0)
-	 	 Laser[current].angle = gun_rotation;
-	 glm::mat4 rotateLaser = glm::rotate ((float)(Laser[current].angle*M_PI/180.0f), glm::vec3(0,0,1));
-	 prodLaser *= rotateLaser;
-	 Matrices.model *= (prodLaser);
-	 MVP = VP * Matrices.model;
-	 glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	 draw3DObject(Laser[current].object);
-	 if(Laser[current].status == 1){
-	 Laser[current].x += (Laser[current].speed)*cos((Laser[current].angle*M_PI/180.0f));
-	 Laser[current].y += (Laser[current].speed)*sin((Laser[current].angle*M_PI/180.0f));
-	}
-  }
-  laser_trans_status = 0;
-  string laser = "laser" + to_string(laser_count);
-  if(glfwGetTime()-click_time>=1 && Laser[laser].status==1)
-  {
-	//   cout << laser_count << ' ' << laser << endl;
-	  Color red = {1,0,0};
-	  laser = "laser" + to_string(laser_count+1);
-	  createRectangle(laser,"Laser",red,0.15,0.04,-3.6,gun_translation,0);
-	  laser_count++;
-  }
-
-  for(it=Laser.begin();it!=Laser.end();it++)
-  {
-	  string curr1 = it->first;
-	  Point P1,P2,P3,P4;
-	  int chk;
-	  if(Laser[curr1].status == 0)
-	  	continue;
-	  for(xy=Mirror.begin();xy!=Mirror.end();xy++)
+	  PROFILE_SCOPE("draw baskets");
+	  renderPass(render_queue, PASS_BASKETS);
+	  for(int i=0;i<Basket.count;i++)
 	  {
-		  string curr2 = xy->first;
-		  P1.x = Laser[curr1].x + (Laser[curr1].len/2)*cos((Laser[curr1].angle*M_PI/180.0f));
-		  P1.y = Laser[curr1].y + (Laser[curr1].len/2)*sin((Laser[curr1].angle*M_PI/180.0f));
-		  P2.x = Laser[curr1].x - (Laser[curr1].len/2)*cos((Laser[curr1].angle*M_PI/180.0f));
-		  P2.y = Laser[curr1].y - (Laser[curr1].len/2)*sin((Laser[curr1].angle*M_PI/180.0f));
-		  P3.x = Mirror[curr2].x + (Mirror[curr2].len/2)*cos((Mirror[curr2].angle*M_PI/180.0f));
-		  P3.y = Mirror[curr2].y + (Mirror[curr2].len/2)*sin((Mirror[curr2].angle*M_PI/180.0f));
-		  P4.x = Mirror[curr2].x - (Mirror[curr2].len/2)*cos((Mirror[curr2].angle*M_PI/180.0f));
-		  P4.y = Mirror[curr2].y - (Mirror[curr2].len/2)*sin((Mirror[curr2].angle*M_PI/180.0f));
-		  chk = intersect_point(P1,P2,P3,P4);
-		  if(chk == 1)
-		  {
-			  Laser[curr1].x = x_intersection;
-			  Laser[curr1].y = y_intersection;
-			  Laser[curr1].angle = (2*Mirror[curr2].angle) - Laser[curr1].angle;
-			  Laser[curr1].speed = 0.18;
+		  float x = lerp(Basket.prev_x[i], Basket.x[i], alpha);
+		  if(i == red_rim.index || i == green_rim.index){
+			// Rims are tilted out of the screen plane, which needs a full matrix
+			glm::mat4 translateBasket = glm::translate (glm::vec3(x, Basket.y[i], 0.0f));
+			glm::mat4 rotateBasket = glm::rotate((float)(70*M_PI/180.0f), glm::vec3(1,0,0));
+			renderSubmit(render_queue, LAYER_SCENE, Basket.object[i], translateBasket*rotateBasket, Basket.color[i]);
 		  }
+		  else
+			renderSubmit(render_queue, LAYER_SCENE, Basket.object[i], x, Basket.y[i], 0.0f, 0, Basket.color[i]);
 	  }
   }
 
-  bool check;
-  for(it=Laser.begin();it!=Laser.end();it++)
   {
-	  string curr1 = it->first;
-	  if(Laser[curr1].status == 0 || Laser[curr1].flag == -1)
-	  	continue;
-	  float theta = (Laser[curr1].angle*M_PI/180.0f);
-	  for(xy=Brick.begin();xy!=Brick.end();xy++)
-	  {
-		  string curr2 = xy->first;
-		  if(Brick[curr2].flag == -1)
-		  	continue;
-		  check = checkintersection (Laser[curr1].x+(Laser[curr1].len/2)*cos(theta), Laser[curr1].y+(Laser[curr1].len/2)*sin(theta), Laser[curr1].x-(Laser[curr1].len/2)*cos(theta), Laser[curr1].y-(Laser[curr1].len/2)*sin(theta), Brick[curr2].x-Brick[curr2].len/2, Brick[curr2].y+Brick[curr2].breadth/2, Brick[curr2].x-Brick[curr2].len/2 , Brick[curr2].y-Brick[curr2].breadth/2);
-		  if(check == true){
-		  	Laser[curr1].flag = -1;
-			Brick[curr2].flag = -1;
-			if(Brick[curr2].color.r==0 && Brick[curr2].color.g==0 && Brick[curr2].color.b==0 ){
-				points+=10;
-			}
-			else{
-				points-=2;
-				misfire++;
-				if(misfire==5){
-					cout << points << endl;
-					exit(0);
-				}
-			}
-		}
-	  }
+	  PROFILE_SCOPE("draw mirrors");
+	  renderPass(render_queue, PASS_MIRRORS);
+	  for(int i=0;i<Mirror.count;i++)
+		  renderSubmit(render_queue, LAYER_SCENE, Mirror.object[i], Mirror.x[i], Mirror.y[i], 0.0f, Mirror.angle[i], Mirror.color[i]);
   }
 
-  for(it=Basket.begin();it!=Basket.end();it++)
   {
-	  string curr1 = it->first;
-	  Color black = {0,0,0};
-	//   cout << curr1 << endl;
-	  for(xy=Brick.begin();xy!=Brick.end();xy++)
+	  PROFILE_SCOPE("draw lasers");
+	  renderPass(render_queue, PASS_LASERS);
+	  for(int i=0;i<Laser.count;i++)
 	  {
-		  string curr2 = xy->first;
-		  if(Brick[curr2].flag == -1)
-			continue;
-		  check = brick_coll_basket(curr1,curr2);
-		  if(check == true){
-			 	Brick[curr2].flag = -1;
-				if(Brick[curr2].color.r==0 && Brick[curr2].color.g==0 && Brick[curr2].color.b==0 ){
-					cout << points << endl;
-					exit(0);
-				}
-				else if(Brick[curr2].color.r==1 && Brick[curr2].color.g==0 && Brick[curr2].color.b==0 && Basket[curr1].color.r==1 && Basket[curr1].color.g==0 && Basket[curr1].color.b==0)
-					points+=5;
-				else if(Brick[curr2].color.r==0 && Brick[curr2].color.g==1 && Brick[curr2].color.b==0 && Basket[curr1].color.r==0 && Basket[curr1].color.g==1 && Basket[curr1].color.b==0)
-					points+=5;
-				else                              //bricks collected in wrong baskets
-					points-=2;
-			}
+		 if (Laser.flag[i] == -1)
+		 	continue;
+		 renderSubmit(render_queue, LAYER_PROJECTILES, Laser.object[i], lerp(Laser.prev_x[i], Laser.x[i], alpha), lerp(Laser.prev_y[i], Laser.y[i], alpha), -1.0f, lerp(Laser.prev_angle[i], Laser.angle[i], alpha), Laser.color[i]);
 	  }
   }
+  {
+	  PROFILE_SCOPE("render flush");
+	  renderQueueFlush(render_queue, VP);
+  }
+  streamEndFrame(instance_stream);
   //drawCircle
   // Matrices.model = glm::mat4(1.0f);
   // glm::mat4 translateCircle = glm::translate (glm::vec3(0.0f, 0.0f, 0.0f));
@@ -1017,31 +1589,6 @@ void draw ()
   // // draw3DObject draws the VAO given to it using current MVP matrix
   // draw3DObject(gun[1]);
 
-  // Increment angles
-  float increments = 1;
-
-  //camera_rotation_angle++; // Simulating camera rotation
-  // triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
-  red_basket_translation = red_basket_translation + red_basket_trans_dir*red_basket_trans_status;
-  green_basket_translation = green_basket_translation + green_basket_trans_dir*green_basket_trans_status;
-  gun_translation = gun_translation + gun_trans_dir*gun_trans_status;
-  gun_rotation = gun_rotation + gun_rot_dir*gun_rot_status;
-  if(gun_rotation >= 60)
-  	gun_rotation = 60;
-  else if(gun_rotation <= -60)
-  	gun_rotation = -60;
-  if(gun_translation > 3.44f)
-  	gun_translation = 3.44f;
-  else if(gun_translation < -1.64f)
-  	gun_translation = -1.64f;
-  if(green_basket_translation>3.4f)
-  	green_basket_translation = 3.4f;
-  else if(green_basket_translation < -3.4f)
-  	green_basket_translation = -3.4f;
-  if(red_basket_translation > 3.4f)
-  	red_basket_translation = 3.4f;
-  else if(red_basket_translation < -3.4f)
-  	red_basket_translation = -3.4f;
   if(m_flag3 && zoom>0){
 		pan -= (m_click_x - mouse_x);
 		m_click_x = mouse_x;
@@ -1053,15 +1600,6 @@ void draw ()
    }
 
 }
-void brickdown()
-{
-	map<string,gameObjects>::iterator it;
-	for(it=Brick.begin();it!=Brick.end();it++)
-	{
-		string current = it->first;
-		Brick[current].y = Brick[current].y - brick_speed;
-	}
-}
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
 GLFWwindow* initGLFW (int width, int height)
@@ -1101,13 +1639,13 @@ GLFWwindow* initGLFW (int width, int height)
     glfwSetWindowCloseCallback(window, quit);
 
     /* Register function to handle keyboard input */
-    glfwSetKeyCallback(window, keyboard);      // general keyboard input
+    glfwSetKeyCallback(window, inputKey);      // general keyboard input
     glfwSetCharCallback(window, keyboardChar);  // simpler specific character handling
 
     /* Register function to handle mouse click */
-    glfwSetMouseButtonCallback(window, mouseButton);  // mouse button clicks
-	glfwSetCursorPosCallback(window, cursor_position);
-	glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, inputMouseButton);  // mouse button clicks
+	glfwSetCursorPosCallback(window, inputCursor);
+	glfwSetScrollCallback(window, inputScroll);
 
     return window;
 }
@@ -1117,39 +1655,17 @@ GLFWwindow* initGLFW (int width, int height)
 void initGL (GLFWwindow* window, int width, int height)
 {
     /* Objects should be created before any other gl function and shaders */
+	stateInvalidate();
 	// Create the models
 	// createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-	Color blue = {0,0,1};
-	Color green = {0,1,0};
-	Color red = {1,0,0};
-	Color grey = {168.0/255.0,168.0/255.0,168.0/255.0};
-	Color gold = {218.0/255.0,165.0/255.0,32.0/255.0};
-	Color yellow = {1,1,0};
-	Color skyblue = {132/255.0,217/255.0,245/255.0};
-	Color black = {0,0,0};
-	Color white = {255/255.0,255/255.0,255/255.0};
-
-	map<int,Color> colormap;
-	colormap[0] = black;
-	colormap[1] = red;
-	colormap[2] = green;
-	// createRectangle("gun1","Gun",black,0.35,0.2,-3.8,0,0);
-	createCircle("gun1","Gun",black,0.56,-4.0,0,1);
-	createRectangle("gun2","Gun",black,0.23,0.10,-3.4,0,0);
-	createCircle("gun3","Gun",red,0.09,-3.7f,0.0f,1);
-	createRectangle("laser1","Laser",red,0.15,0.04,-3.6,0.0,0);
-	createRectangle("redbasket","Basket",red,0.6,0.5,-3.0,-3.0,0);
-	createCircle("redcircle","Basket",grey,0.6,0.0,-2.5,1);
-	createRectangle("greenbasket","Basket",green,0.6,0.5,3.0,-3.0,0);
-	createCircle("greencircle","Basket",grey,0.6,0.0,-2.5,1);
-	createRectangle("mirror1","Mirror",white,0.45,0.04,2.8,2.5,120);
-	createRectangle("mirror2","Mirror",white,0.45,0.04,-1.4,1.4,70);
-	createRectangle("mirror3","Mirror",white,0.45,0.04,0.9,-1.4,60);
-	createRectangle("line","Line",black,7.0,0.01,0.0,-2.22,0);
+	createStreamBuffer(instance_stream, 64*1024);
+	createGpuTimers(gpu_timers);
 	// Create and compile our GLSL program from the shaders
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
 	// Get a handle for our "MVP" uniform
 	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	CircleRadiusID = glGetUniformLocation(programID, "circleRadius");
+	CircleArcID = glGetUniformLocation(programID, "circleArc");
 
 
 	reshapeWindow (window, width, height);
@@ -1161,40 +1677,317 @@ void initGL (GLFWwindow* window, int width, int height)
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
 
+	// Anti-aliased circle edges come out of the fragment shader as alpha
+	glEnable (GL_BLEND);
+	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
     // cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
     // cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
     // cout << "VERSION: " << glGetString(GL_VERSION) << endl;
     // cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Renderer counters for the whole run */
+void renderReport ()
+{
+    cout << "geometry cache: " << geometry_cache_hits << " hits, " << geometry_cache_misses << " misses" << endl;
+    cout << "render queue: " << render_queue.TotalItems << " items in " << render_queue.TotalDraws << " draws" << endl;
+    cout << "gl state cache: " << gl_state.TotalIssued << " calls issued, " << gl_state.TotalAvoided << " avoided" << endl;
+    if (gpu_timers.FramesTimed > 0 || gpu_timers.FramesFull > 0) {
+        cout << "gpu ms/frame:";
+        for (int p=0; p<RENDER_PASSES && gpu_timers.FramesTimed > 0; p++)
+            cout << " " << render_pass_names[p] << " " << gpu_timers.TotalMs[p] / gpu_timers.FramesTimed;
+        cout << " (" << gpu_timers.FramesTimed << " frames timed, " << gpu_timers.FramesSkipped << " skipped, " << gpu_timers.FramesFull << " out of queries)" << endl;
+    }
+    cout << "instance stream: " << instance_stream.TotalBytes << " bytes, " << instance_stream.TotalFenceWaits << " fence waits" << (instance_stream.Persistent ? " (persistent)" : " (orphaning)")
+         << "; last frame " << instance_stream.LastBytes << " bytes, " << instance_stream.LastFenceWaits << " fence waits" << endl;
+}
+
+// Game time a headless run covers unless --ticks says otherwise
+#define HEADLESS_DEFAULT_TICKS (10*60*SIM_HZ)
+
+chrono::steady_clock::time_point headless_start;
+
+/* Ticks played and how fast */
+void headlessReport ()
+{
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - headless_start).count();
+    cerr << "headless: " << sim_ticks << " ticks (" << sim_time << " s game time) in " << seconds << " s, " << (long)(sim_ticks / seconds) << " ticks/s" << endl;
+}
+
+/* Run the simulation flat out with no window, GL context or vsync */
+int runHeadless (long max_ticks, uint64_t seed)
+{
+    initGame(seed);
+    headless_start = chrono::steady_clock::now();
+    atexit(headlessReport);
+    while (sim_ticks < max_ticks && !replayFinished())
+        step();
+    cout << points << endl;
+    return 0;
+}
+
+#ifdef OFFSCREEN_EGL
+/* Offscreen rendering for machines without a display: an EGL pbuffer
+   stands in for the window, on Mesa's surfaceless platform when there is
+   one (llvmpipe needs nothing else), else on the default display. The
+   renderer runs unchanged on it, initGL included */
+EGLDisplay offscreen_display = EGL_NO_DISPLAY;
+EGLSurface offscreen_surface = EGL_NO_SURFACE;
+
+bool createOffscreenContext (int width, int height)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        offscreen_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (offscreen_display == EGL_NO_DISPLAY)
+        offscreen_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (offscreen_display == EGL_NO_DISPLAY || !eglInitialize(offscreen_display, &major, &minor)) {
+        cerr << "offscreen: no EGL display" << endl;
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configs = 0;
+    if (!eglChooseConfig(offscreen_display, config_attribs, &config, 1, &configs) || configs == 0 || !eglBindAPI(EGL_OPENGL_API)) {
+        cerr << "offscreen: no desktop GL pbuffer config" << endl;
+        return false;
+    }
+
+    // The same 3.3 core context initGLFW asks for
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(offscreen_display, config, EGL_NO_CONTEXT, context_attribs);
+    const EGLint surface_attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    offscreen_surface = eglCreatePbufferSurface(offscreen_display, config, surface_attribs);
+    if (context == EGL_NO_CONTEXT || offscreen_surface == EGL_NO_SURFACE || !eglMakeCurrent(offscreen_display, offscreen_surface, offscreen_surface, context)) {
+        cerr << "offscreen: cannot create a GL 3.3 core context" << endl;
+        return false;
+    }
+    gladLoadGLLoader((GLADloadproc) eglGetProcAddress);
+    return true;
+}
+#endif
+
+/* A dump pattern is a printf format for the frame number, so it must hold
+   exactly one %d, which may carry flags and a width as in %05d; any other
+   % has to be written %% */
+bool dumpPatternValid (const char* pattern)
+{
+    int conversions = 0;
+    for (const char* p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        if (*++p == '%')
+            continue;
+        while (*p && strchr("-+ #0", *p))
+            p++;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        if (*p != 'd')
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+/* Save the frame just drawn as a binary PPM, top row first */
+bool dumpFrame (const char* path, int width, int height)
+{
+    vector<unsigned char> pixels(width*height*3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y=height-1; y>=0; y--)
+        fwrite(&pixels[y*width*3], 1, width*3, file);
+    return fclose(file) == 0;
+}
+
+long offscreen_frames = 0;
+chrono::steady_clock::time_point offscreen_start;
+
+/* Frames drawn and how fast, then the renderer counters */
+void offscreenReport ()
+{
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - offscreen_start).count();
+    cerr << "offscreen: " << offscreen_frames << " frames in " << seconds << " s, " << offscreen_frames / seconds << " frames/s" << endl;
+    renderReport();
+}
+
+/* Render the game with no window. The clock is fixed at one tick per frame,
+   so the same seed and input draw the same frames on every run. With a
+   dump pattern, every dump_every-th frame is saved to
+   printf(dump_pattern, frame); main checks the pattern with dumpPatternValid */
+int runOffscreen (int width, int height, long max_ticks, uint64_t seed, const char* dump_pattern, long dump_every)
+{
+#ifdef OFFSCREEN_EGL
+    if (!createOffscreenContext(width, height))
+        return 1;
+    initGame(seed);
+    initGL(NULL, width, height);
+    offscreen_start = chrono::steady_clock::now();
+    atexit(offscreenReport);
+    while (sim_ticks < max_ticks && !replayFinished()) {
+        PROFILE_SCOPE("frame");
+        {
+            PROFILE_SCOPE("simulate");
+            step();
+        }
+        // Draw the tick just played, not the one before it
+        draw(1);
+        offscreen_frames++;
+        if (dump_pattern && offscreen_frames % dump_every == 0) {
+            char path[4096];
+            if (snprintf(path, sizeof(path), dump_pattern, (int)offscreen_frames) >= (int)sizeof(path) || !dumpFrame(path, width, height)) {
+                cerr << path << ": cannot write frame" << endl;
+                return 1;
+            }
+        }
+        {
+            PROFILE_SCOPE("eglSwapBuffers");
+            eglSwapBuffers(offscreen_display, offscreen_surface);
+        }
+    }
+    return 0;
+#else
+    (void) width; (void) height; (void) max_ticks; (void) seed; (void) dump_pattern; (void) dump_every;
+    cerr << "offscreen rendering needs a build with EGL (make OFFSCREEN=1)" << endl;
+    return 1;
+#endif
+}
+
 int main (int argc, char** argv)
 {
 	int width = 600;
 	int height = 600;
+	long max_ticks = -1;
+	uint64_t seed = GAME_DEFAULT_SEED;
+	const char* record_path = NULL;
+	const char* replay_path = NULL;
+	int threads = 0;
+	bool offscreen = false;
+	const char* dump_pattern = NULL;
+	long dump_every = 1;
+
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--ticks") == 0 && i+1 < argc)
+			max_ticks = atol(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc)
+			seed = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--record") == 0 && i+1 < argc)
+			record_path = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0 && i+1 < argc)
+			replay_path = argv[++i];
+		else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+			threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc)
+			profile_path = argv[++i];
+		else if (strcmp(argv[i], "--offscreen") == 0)
+			offscreen = true;
+		else if (strcmp(argv[i], "--dump") == 0 && i+1 < argc)
+			dump_pattern = argv[++i];
+		else if (strcmp(argv[i], "--dump-every") == 0 && i+1 < argc && atol(argv[i+1]) > 0)
+			dump_every = atol(argv[++i]);
+		else {
+			cerr << "usage: " << argv[0] << " [--headless | --offscreen [--dump PATTERN] [--dump-every N]] [--ticks N] [--seed N] [--record FILE] [--replay FILE] [--threads N] [--profile FILE]" << endl;
+			return 1;
+		}
+	}
+
+	if (dump_pattern && !dumpPatternValid(dump_pattern)) {
+		cerr << dump_pattern << ": a dump pattern needs exactly one %d for the frame number" << endl;
+		return 1;
+	}
+	if (replay_path && !startReplay(replay_path, seed)) {
+		cerr << replay_path << ": not a readable input log" << endl;
+		return 1;
+	}
+	/* The log, the trace and the end-of-run reports are all finished from
+	   atexit handlers, here and in the run loops, since game over leaves
+	   through exit() */
+	if (record_path) {
+		if (!inputLogCreate(input_record, record_path, seed)) {
+			cerr << record_path << ": cannot write input log" << endl;
+			return 1;
+		}
+		recording = true;
+		atexit(finishRecording);
+	}
+
+	// Before jobs_init, so the workers name themselves in the trace
+	if (profile_path) {
+		profile_enable();
+		profile_thread_name("main");
+		atexit(writeProfile);
+	}
+
+	// Big scenes spread each tick over these; small ones stay on this thread
+	jobs_init(threads);
+
+	if (headless)
+		// A replay runs to its end unless --ticks cuts it short
+		return runHeadless(max_ticks >= 0 ? max_ticks : replaying ? LONG_MAX : HEADLESS_DEFAULT_TICKS, seed);
+	if (offscreen)
+		return runOffscreen(width, height, max_ticks >= 0 ? max_ticks : replaying ? LONG_MAX : HEADLESS_DEFAULT_TICKS, seed, dump_pattern, dump_every);
 
     GLFWwindow* window = initGLFW(width, height);
+    replay_window = window;
 
+	initGame(seed);
 	initGL (window, width, height);
+	atexit(renderReport);
 
-    double last_update_time = glfwGetTime(), current_time;
+    double frame_start = glfwGetTime(), accumulator = 0;
 
     /* Draw in loop */
-    while (!glfwWindowShouldClose(window)) {
+    while (!glfwWindowShouldClose(window) && (max_ticks < 0 || sim_ticks < max_ticks) && !replayFinished()) {
+        PROFILE_SCOPE("frame");
+
+        // Run as many fixed ticks as the wall clock has moved on
+        double now = glfwGetTime();
+        double frame_time = now - frame_start;
+        frame_start = now;
+        if (frame_time > SIM_MAX_FRAME_TIME)
+            frame_time = SIM_MAX_FRAME_TIME;
+        accumulator += frame_time;
+        {
+            PROFILE_SCOPE("simulate");
+            while (accumulator >= SIM_DT) {
+                step();
+                accumulator -= SIM_DT;
+            }
+        }
 
         // OpenGL Draw commands
-        draw();
+        draw(accumulator / SIM_DT);
 
         // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+        {
+            PROFILE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
 
         // Poll for Keyboard and mouse events
-        glfwPollEvents();
-
-        // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-        current_time = glfwGetTime(); // Time in seconds
-        if ((current_time - last_update_time) >= 0.05) { // atleast 0.5s elapsed since last frame
-            brickdown();
-            last_update_time = current_time;
+        {
+            PROFILE_SCOPE("glfwPollEvents");
+            glfwPollEvents();
         }
     }
     glfwTerminate();
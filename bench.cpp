@@ -0,0 +1,451 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "game_sim.h"
+#include "collide.h"
+#include "jobs.h"
+
+using namespace std;
+
+/* Microbenchmarks for the hot paths of the game: the collision tests, entity
+   creation, the entity store against the string-keyed maps it replaced, the
+   laser/brick batch kernels and whole simulation ticks. Every benchmark runs
+   BENCH_SAMPLES timed samples after a calibration round and prints one CSV
+   line, so runs from two commits can be diffed or joined on benchmark,n:
+
+     benchmark,n,ns_per_op,ops_per_sec,stddev_ns,min_ns,samples
+
+   ns_per_op is the mean over the samples and stddev_ns their spread. */
+
+#define BENCH_SAMPLES 10
+#define BENCH_SAMPLE_SECONDS 0.02
+#define BENCH_LASERS 64
+// Ticks played on one scene before it is built again, short enough that no
+// brick reaches the baskets or the floor
+#define BENCH_SCENE_TICKS 60
+
+// The vertex data a geometry cache miss uploads, which the create benchmarks
+// build with each entity
+float bench_vertices[GEOMETRY_VERTEX_FLOATS];
+
+static uint32_t bench_state = 12345;
+
+static float bench_float (float lo, float hi)
+{
+	bench_state = bench_state*1664525u + 1013904223u;
+	return lo + (hi - lo)*(bench_state >> 8)*(1.0f/16777216.0f);
+}
+
+// Results go here so the compiler cannot drop the work
+volatile float bench_sink;
+
+/* A benchmark does reps rounds of its operation on a working set of n,
+   sets ops to the operations done and returns the seconds they took.
+   Setup it does outside the timed part is not counted */
+typedef double (*BenchFunc) (int n, long reps, long& ops);
+
+static double bench_seconds (chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static const char* bench_filter = NULL;
+static int bench_failures = 0;
+
+/* Double reps until a sample takes BENCH_SAMPLE_SECONDS, then time
+   BENCH_SAMPLES samples of that many reps and print the line */
+static void bench_run (const char* name, int n, BenchFunc func)
+{
+	if(bench_filter && strstr(name, bench_filter) == NULL)
+		return;
+	long reps = 1, ops;
+	while(func(n, reps, ops) < BENCH_SAMPLE_SECONDS)
+		reps *= 2;
+
+	double ns[BENCH_SAMPLES], mean = 0, least = 0;
+	for(int s=0;s<BENCH_SAMPLES;s++){
+		double seconds = func(n, reps, ops);
+		ns[s] = seconds*1e9/ops;
+		mean += ns[s]/BENCH_SAMPLES;
+		if(s == 0 || ns[s] < least)
+			least = ns[s];
+	}
+	double variance = 0;
+	for(int s=0;s<BENCH_SAMPLES;s++)
+		variance += (ns[s] - mean)*(ns[s] - mean)/(BENCH_SAMPLES - 1);
+	printf("%s,%d,%.3f,%.0f,%.3f,%.3f,%d\n", name, n, mean, 1e9/mean, sqrt(variance), least, BENCH_SAMPLES);
+	fflush(stdout);
+}
+
+/* n random segment pairs, four points each */
+static vector<Point> bench_segments (int n)
+{
+	bench_state = 12345;
+	vector<Point> points(4*n);
+	for(int i=0;i<4*n;i++){
+		points[i].x = bench_float(-4, 4);
+		points[i].y = bench_float(-4, 4);
+	}
+	return points;
+}
+
+static double bench_intersect_point (int n, long reps, long& ops)
+{
+	vector<Point> p = bench_segments(n);
+	int hits = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int i=0;i<n;i++)
+			hits += intersect_point(p[4*i], p[4*i+1], p[4*i+2], p[4*i+3]);
+	double seconds = bench_seconds(start);
+	bench_sink = hits;
+	ops = reps*n;
+	return seconds;
+}
+
+static double bench_checkintersection (int n, long reps, long& ops)
+{
+	vector<Point> p = bench_segments(n);
+	int hits = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int i=0;i<n;i++)
+			hits += checkintersection(p[4*i].x, p[4*i].y, p[4*i+1].x, p[4*i+1].y, p[4*i+2].x, p[4*i+2].y, p[4*i+3].x, p[4*i+3].y);
+	double seconds = bench_seconds(start);
+	bench_sink = hits;
+	ops = reps*n;
+	return seconds;
+}
+
+/* n black bricks between heights low and high, created lowest first */
+static void bench_bricks (int n, float low, float high)
+{
+	game_reset();
+	Color black = {0,0,0};
+	for(int i=0;i<n;i++){
+		EntityHandle brick = createRectangle(Brick, black, 0.08, 0.18, bench_float(-4, 4), low + (high - low)*i/n, 0);
+		brick_order_insert(brick.index);
+	}
+}
+
+static double bench_brick_coll_basket (int n, long reps, long& ops)
+{
+	bench_state = 12345;
+	bench_bricks(n, -2.6, -2.3);
+	int caught = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int k=0;k<Basket.count;k++)
+			for(int b=0;b<Brick.count;b++)
+				caught += brick_coll_basket(k, b);
+	double seconds = bench_seconds(start);
+	bench_sink = caught;
+	ops = reps*Basket.count*Brick.count;
+	return seconds;
+}
+
+EntityStore bench_store;
+
+static double bench_create_rectangle (int n, long reps, long& ops)
+{
+	Color black = {0,0,0};
+	double seconds = 0;
+	for(long r=0;r<reps;r++){
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int i=0;i<n;i++){
+			createRectangle(bench_store, black, 0.08, 0.18, 0, 0, 0);
+			rectangleVertices(0.08, 0.18, bench_vertices);
+		}
+		seconds += bench_seconds(start);
+		for(int i=0;i<bench_store.count;i++)
+			store_release(bench_store, i);
+	}
+	ops = reps*n;
+	return seconds;
+}
+
+static double bench_create_circle (int n, long reps, long& ops)
+{
+	Color grey = {0.66,0.66,0.66};
+	double seconds = 0;
+	for(long r=0;r<reps;r++){
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int i=0;i<n;i++){
+			createCircle(bench_store, grey, 0.6, 0, 0, 1);
+			circleVertices(0.6, bench_vertices);
+		}
+		seconds += bench_seconds(start);
+		for(int i=0;i<bench_store.count;i++)
+			store_release(bench_store, i);
+	}
+	ops = reps*n;
+	return seconds;
+}
+
+/* The entity record and string-keyed map the game kept before EntityStore */
+struct MapObject {
+	string name;
+	VAO *object;
+	Color color;
+	int status=0;
+	int flag = 0;
+	float x;
+	float y;
+	float speed;
+	float len,breadth,radius;
+	float angle=0;
+};
+typedef struct MapObject MapObject;
+
+static void bench_map (int n, map<string,MapObject>& objects, vector<string>& names)
+{
+	bench_state = 12345;
+	for(int i=0;i<n;i++){
+		MapObject object = {};
+		object.name = "brick" + to_string(i);
+		object.y = bench_float(-4, 4);
+		objects[object.name] = object;
+		names.push_back(object.name);
+	}
+	// Look them up in no particular order
+	for(int i=n-1;i>0;i--)
+		swap(names[i], names[(int)bench_float(0, (float)i)]);
+}
+
+static void bench_handles (int n, vector<EntityHandle>& handles)
+{
+	bench_state = 12345;
+	bench_store = EntityStore();
+	Color black = {0,0,0};
+	for(int i=0;i<n;i++)
+		handles.push_back(createRectangle(bench_store, black, 0.08, 0.18, 0, bench_float(-4, 4), 0));
+	for(int i=n-1;i>0;i--)
+		swap(handles[i], handles[(int)bench_float(0, (float)i)]);
+}
+
+/* Every object moved once, the way brickdown walked the map */
+static double bench_map_walk (int n, long reps, long& ops)
+{
+	map<string,MapObject> objects;
+	vector<string> names;
+	bench_map(n, objects, names);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++){
+		map<string,MapObject>::iterator it;
+		for(it=objects.begin();it!=objects.end();it++){
+			string current = it->first;
+			objects[current].y = objects[current].y - 0.05f;
+		}
+	}
+	double seconds = bench_seconds(start);
+	bench_sink = objects.begin()->second.y;
+	ops = reps*n;
+	return seconds;
+}
+
+static double bench_store_walk (int n, long reps, long& ops)
+{
+	vector<EntityHandle> handles;
+	bench_handles(n, handles);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int i=0;i<bench_store.count;i++)
+			if(bench_store.flag[i] != -1)
+				bench_store.y[i] = bench_store.y[i] - 0.05f;
+	double seconds = bench_seconds(start);
+	bench_sink = bench_store.y[0];
+	ops = reps*n;
+	return seconds;
+}
+
+/* One object looked up by name, against the same through a handle */
+static double bench_map_lookup (int n, long reps, long& ops)
+{
+	map<string,MapObject> objects;
+	vector<string> names;
+	bench_map(n, objects, names);
+	float sum = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int i=0;i<n;i++)
+			sum += objects[names[i]].y;
+	double seconds = bench_seconds(start);
+	bench_sink = sum;
+	ops = reps*n;
+	return seconds;
+}
+
+static double bench_store_lookup (int n, long reps, long& ops)
+{
+	vector<EntityHandle> handles;
+	bench_handles(n, handles);
+	float sum = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int i=0;i<n;i++)
+			if(store_valid(bench_store, handles[i]))
+				sum += bench_store.y[handles[i].index];
+	double seconds = bench_seconds(start);
+	bench_sink = sum;
+	ops = reps*n;
+	return seconds;
+}
+
+/* Laser sweeps of the in-game length, start point and direction random,
+   against n random brick boxes */
+static float bench_lasers[4*BENCH_LASERS];
+static vector<float> bench_x0, bench_y0, bench_x1, bench_y1;
+
+static void bench_boxes (int n)
+{
+	bench_state = 12345;
+	for(int l=0;l<BENCH_LASERS;l++){
+		float x = bench_float(-4, 4), y = bench_float(-4, 4);
+		float dx = bench_float(-1, 1), dy = bench_float(-1, 1);
+		bench_lasers[4*l] = x;
+		bench_lasers[4*l+1] = y;
+		bench_lasers[4*l+2] = x + 0.33f*dx;
+		bench_lasers[4*l+3] = y + 0.33f*dy;
+	}
+	bench_x0.clear();
+	bench_y0.clear();
+	bench_x1.clear();
+	bench_y1.clear();
+	for(int b=0;b<n;b++){
+		float x = bench_float(-4, 4), y = bench_float(-4, 4);
+		bench_x0.push_back(x - 0.04f);
+		bench_y0.push_back(y - 0.09f);
+		bench_x1.push_back(x + 0.04f);
+		bench_y1.push_back(y + 0.09f);
+	}
+}
+
+/* Every laser against all boxes once per rep; ops are box tests */
+static double bench_first_box_hit (int n, long reps, long& ops)
+{
+	bench_boxes(n);
+	int hits = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(long r=0;r<reps;r++)
+		for(int l=0;l<BENCH_LASERS;l++){
+			const float* s = bench_lasers + 4*l;
+			float t;
+			hits += first_box_hit(s[0], s[1], s[2], s[3], &bench_x0[0], &bench_y0[0], &bench_x1[0], &bench_y1[0], n, t);
+		}
+	double seconds = bench_seconds(start);
+	bench_sink = hits;
+	ops = reps*BENCH_LASERS*n;
+	return seconds;
+}
+
+/* The first hit of every laser and when, under the selected kernel */
+static void bench_answers (int n, vector<int>& hits, vector<float>& times)
+{
+	bench_boxes(n);
+	hits.resize(BENCH_LASERS);
+	times.assign(BENCH_LASERS, -1);
+	for(int l=0;l<BENCH_LASERS;l++){
+		const float* s = bench_lasers + 4*l;
+		hits[l] = first_box_hit(s[0], s[1], s[2], s[3], &bench_x0[0], &bench_y0[0], &bench_x1[0], &bench_y1[0], n, times[l]);
+	}
+}
+
+/* n black bricks over the upper play area and n/10 lasers flying through
+   them, at least one */
+static void bench_scene (int n)
+{
+	bench_state = 12345;
+	bench_bricks(n, -1, 4);
+	Color red = {1,0,0};
+	for(int i=0;i<n/10 || i==0;i++){
+		EntityHandle laser = createRectangle(Laser, red, 0.15, 0.04, bench_float(-4, 4), bench_float(-4, 4), bench_float(0, 360));
+		Laser.status[laser.index] = 1;
+		Laser.speed[laser.index] = 0.11;
+	}
+}
+
+/* Whole ticks, as the headless game plays them; ops are ticks */
+static double bench_tick (int n, long reps, long& ops)
+{
+	double seconds = 0;
+	for(long done=0;done<reps;){
+		// The first tick files the new bricks in the grid; that is setup too
+		bench_scene(n);
+		tick();
+		long ticks = reps - done < BENCH_SCENE_TICKS ? reps - done : BENCH_SCENE_TICKS;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(long t=0;t<ticks;t++)
+			tick();
+		seconds += bench_seconds(start);
+		done += ticks;
+	}
+	ops = reps;
+	return seconds;
+}
+
+int main (int argc, char** argv)
+{
+	int threads = 1;
+	for(int i=1;i<argc;i++){
+		if(strcmp(argv[i], "--filter") == 0 && i+1 < argc)
+			bench_filter = argv[++i];
+		else if(strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+			threads = atoi(argv[++i]);
+		else{
+			fprintf(stderr, "usage: %s [--filter TEXT] [--threads N]\n", argv[0]);
+			return 2;
+		}
+	}
+	jobs_init(threads);
+	initGame(GAME_DEFAULT_SEED);
+
+	static const int sizes[] = { 10, 1000, 100000 };
+	printf("benchmark,n,ns_per_op,ops_per_sec,stddev_ns,min_ns,samples\n");
+	for(size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++){
+		int n = sizes[s];
+		bench_run("intersect_point", n, bench_intersect_point);
+		bench_run("checkintersection", n, bench_checkintersection);
+		bench_run("brick_coll_basket", n, bench_brick_coll_basket);
+		bench_run("createRectangle", n, bench_create_rectangle);
+		bench_run("createCircle", n, bench_create_circle);
+		bench_run("map_walk", n, bench_map_walk);
+		bench_run("store_walk", n, bench_store_walk);
+		bench_run("map_lookup", n, bench_map_lookup);
+		bench_run("store_lookup", n, bench_store_lookup);
+		bench_run("tick", n, bench_tick);
+	}
+
+	// Each kernel the CPU supports, checked against the scalar one
+	static const int box_sizes[] = { 1000, 10000, 100000 };
+	static const CollideIsa isas[] = { COLLIDE_SCALAR, COLLIDE_SSE2, COLLIDE_AVX2 };
+	CollideIsa chosen = collide_isa();
+	for(size_t s=0;s<sizeof(box_sizes)/sizeof(box_sizes[0]);s++){
+		vector<int> ref_hits, hits;
+		vector<float> ref_times, times;
+		for(size_t k=0;k<sizeof(isas)/sizeof(isas[0]);k++){
+			if(!collide_select(isas[k]))
+				continue;
+			bench_answers(box_sizes[s], hits, times);
+			if(isas[k] == COLLIDE_SCALAR){
+				ref_hits = hits;
+				ref_times = times;
+			}
+			else if(hits != ref_hits || memcmp(&times[0], &ref_times[0], sizeof(float)*BENCH_LASERS) != 0){
+				fprintf(stderr, "%s kernel disagrees with scalar at %d bricks\n", collide_isa_name(isas[k]), box_sizes[s]);
+				bench_failures++;
+			}
+			string name = string("first_box_hit_") + collide_isa_name(isas[k]);
+			bench_run(name.c_str(), box_sizes[s], bench_first_box_hit);
+		}
+	}
+	collide_select(chosen);
+	return bench_failures ? 1 : 0;
+}
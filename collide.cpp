@@ -0,0 +1,236 @@
+#include <algorithm>
+
+#include "collide.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLLIDE_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+bool segment_box_toi (float x0, float y0, float x1, float y1, float bx0, float by0, float bx1, float by1, float& t)
+{
+	float p[2] = { x0, y0 }, d[2] = { x1-x0, y1-y0 };
+	float lo[2] = { bx0, by0 }, hi[2] = { bx1, by1 };
+	float enter = 0, leave = 1;
+	for(int a=0;a<2;a++){
+		if(d[a] == 0){
+			// Parallel to this slab: inside it all the way or never
+			if(p[a] < lo[a] || p[a] > hi[a])
+				return false;
+			continue;
+		}
+		float t0 = (lo[a] - p[a])/d[a], t1 = (hi[a] - p[a])/d[a];
+		if(t0 > t1)
+			swap(t0, t1);
+		enter = max(enter, t0);
+		leave = min(leave, t1);
+		if(enter > leave)
+			return false;
+	}
+	t = enter;
+	return true;
+}
+
+typedef int (*BoxHitKernel) (float x0, float y0, float x1, float y1,
+                             const float* bx0, const float* by0, const float* bx1, const float* by1, int n, float& t);
+
+/* Finish a batch with the scalar test from box i on; best and best_t carry
+   the result of the boxes before i */
+static int first_box_hit_tail (float x0, float y0, float x1, float y1,
+                               const float* bx0, const float* by0, const float* bx1, const float* by1, int i, int n, int best, float best_t, float& t)
+{
+	for(;i<n;i++){
+		float ti;
+		if(segment_box_toi(x0, y0, x1, y1, bx0[i], by0[i], bx1[i], by1[i], ti) && (best == -1 || ti < best_t)){
+			best = i;
+			best_t = ti;
+		}
+	}
+	if(best != -1)
+		t = best_t;
+	return best;
+}
+
+static int first_box_hit_scalar (float x0, float y0, float x1, float y1,
+                                 const float* bx0, const float* by0, const float* bx1, const float* by1, int n, float& t)
+{
+	return first_box_hit_tail(x0, y0, x1, y1, bx0, by0, bx1, by1, 0, n, -1, 0, t);
+}
+
+#ifdef COLLIDE_X86
+
+/* The wide kernels follow segment_box_toi step for step with the operands
+   in the same order, so min/max pick the same value on ties and the lanes
+   compute exactly what the scalar test would. The segment is the same in
+   every lane, which keeps the parallel-slab case a plain branch. Each lane
+   keeps its own earliest hit; lanes only see increasing indices, so a
+   strict compare leaves ties with the lowest one */
+
+__attribute__((target("sse2")))
+static inline void slab_sse2 (float p, float d, __m128 lo, __m128 hi, __m128& enter, __m128& leave, __m128& inside)
+{
+	__m128 vp = _mm_set1_ps(p);
+	if(d == 0){
+		inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(vp, lo), _mm_cmple_ps(vp, hi)));
+		return;
+	}
+	__m128 vd = _mm_set1_ps(d);
+	__m128 t0 = _mm_div_ps(_mm_sub_ps(lo, vp), vd), t1 = _mm_div_ps(_mm_sub_ps(hi, vp), vd);
+	enter = _mm_max_ps(_mm_min_ps(t1, t0), enter);
+	leave = _mm_min_ps(_mm_max_ps(t0, t1), leave);
+}
+
+__attribute__((target("sse2")))
+static int first_box_hit_sse2 (float x0, float y0, float x1, float y1,
+                               const float* bx0, const float* by0, const float* bx1, const float* by1, int n, float& t)
+{
+	float dx = x1-x0, dy = y1-y0;
+	__m128 best_t = _mm_set1_ps(2);
+	__m128i best_i = _mm_set1_epi32(-1), idx = _mm_setr_epi32(0, 1, 2, 3);
+	int i = 0;
+	for(;i+4<=n;i+=4){
+		__m128 enter = _mm_setzero_ps(), leave = _mm_set1_ps(1), inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		slab_sse2(x0, dx, _mm_loadu_ps(bx0+i), _mm_loadu_ps(bx1+i), enter, leave, inside);
+		slab_sse2(y0, dy, _mm_loadu_ps(by0+i), _mm_loadu_ps(by1+i), enter, leave, inside);
+		__m128 hit = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(enter, leave), _mm_cmplt_ps(enter, best_t)));
+		best_t = _mm_or_ps(_mm_and_ps(hit, enter), _mm_andnot_ps(hit, best_t));
+		best_i = _mm_or_si128(_mm_and_si128(_mm_castps_si128(hit), idx), _mm_andnot_si128(_mm_castps_si128(hit), best_i));
+		idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+	}
+
+	float lane_t[4];
+	int lane_i[4], best = -1;
+	float first = 0;
+	_mm_storeu_ps(lane_t, best_t);
+	_mm_storeu_si128((__m128i*)lane_i, best_i);
+	for(int l=0;l<4;l++)
+		if(lane_i[l] != -1 && (best == -1 || lane_t[l] < first || (lane_t[l] == first && lane_i[l] < best))){
+			best = lane_i[l];
+			first = lane_t[l];
+		}
+	return first_box_hit_tail(x0, y0, x1, y1, bx0, by0, bx1, by1, i, n, best, first, t);
+}
+
+__attribute__((target("avx2")))
+static inline void slab_avx2 (float p, float d, __m256 lo, __m256 hi, __m256& enter, __m256& leave, __m256& inside)
+{
+	__m256 vp = _mm256_set1_ps(p);
+	if(d == 0){
+		inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(vp, lo, _CMP_GE_OQ), _mm256_cmp_ps(vp, hi, _CMP_LE_OQ)));
+		return;
+	}
+	__m256 vd = _mm256_set1_ps(d);
+	__m256 t0 = _mm256_div_ps(_mm256_sub_ps(lo, vp), vd), t1 = _mm256_div_ps(_mm256_sub_ps(hi, vp), vd);
+	enter = _mm256_max_ps(_mm256_min_ps(t1, t0), enter);
+	leave = _mm256_min_ps(_mm256_max_ps(t0, t1), leave);
+}
+
+__attribute__((target("avx2")))
+static int first_box_hit_avx2 (float x0, float y0, float x1, float y1,
+                               const float* bx0, const float* by0, const float* bx1, const float* by1, int n, float& t)
+{
+	float dx = x1-x0, dy = y1-y0;
+	__m256 best_t = _mm256_set1_ps(2);
+	__m256i best_i = _mm256_set1_epi32(-1), idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int i = 0;
+	for(;i+8<=n;i+=8){
+		__m256 enter = _mm256_setzero_ps(), leave = _mm256_set1_ps(1), inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		slab_avx2(x0, dx, _mm256_loadu_ps(bx0+i), _mm256_loadu_ps(bx1+i), enter, leave, inside);
+		slab_avx2(y0, dy, _mm256_loadu_ps(by0+i), _mm256_loadu_ps(by1+i), enter, leave, inside);
+		__m256 hit = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(enter, leave, _CMP_LE_OQ), _mm256_cmp_ps(enter, best_t, _CMP_LT_OQ)));
+		best_t = _mm256_blendv_ps(best_t, enter, hit);
+		best_i = _mm256_blendv_epi8(best_i, idx, _mm256_castps_si256(hit));
+		idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+	}
+
+	float lane_t[8];
+	int lane_i[8], best = -1;
+	float first = 0;
+	_mm256_storeu_ps(lane_t, best_t);
+	_mm256_storeu_si256((__m256i*)lane_i, best_i);
+	// Leave the upper halves clean for the SSE code around us
+	_mm256_zeroupper();
+	for(int l=0;l<8;l++)
+		if(lane_i[l] != -1 && (best == -1 || lane_t[l] < first || (lane_t[l] == first && lane_i[l] < best))){
+			best = lane_i[l];
+			first = lane_t[l];
+		}
+	return first_box_hit_tail(x0, y0, x1, y1, bx0, by0, bx1, by1, i, n, best, first, t);
+}
+
+#endif
+
+bool collide_supported (CollideIsa isa)
+{
+	switch(isa){
+		case COLLIDE_SCALAR:
+			return true;
+#ifdef COLLIDE_X86
+		case COLLIDE_SSE2:
+			return __builtin_cpu_supports("sse2");
+		case COLLIDE_AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+const char* collide_isa_name (CollideIsa isa)
+{
+	switch(isa){
+		case COLLIDE_SSE2:
+			return "sse2";
+		case COLLIDE_AVX2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+static CollideIsa collide_current;
+static BoxHitKernel collide_kernel = NULL;
+
+bool collide_select (CollideIsa isa)
+{
+	if(!collide_supported(isa))
+		return false;
+	collide_current = isa;
+	switch(isa){
+#ifdef COLLIDE_X86
+		case COLLIDE_SSE2:
+			collide_kernel = first_box_hit_sse2;
+			break;
+		case COLLIDE_AVX2:
+			collide_kernel = first_box_hit_avx2;
+			break;
+#endif
+		default:
+			collide_kernel = first_box_hit_scalar;
+			break;
+	}
+	return true;
+}
+
+CollideIsa collide_isa ()
+{
+	if(collide_kernel == NULL){
+		// First use: take the widest kernel this CPU runs
+		if(!collide_select(COLLIDE_AVX2) && !collide_select(COLLIDE_SSE2))
+			collide_select(COLLIDE_SCALAR);
+	}
+	return collide_current;
+}
+
+int first_box_hit (float x0, float y0, float x1, float y1,
+                   const float* bx0, const float* by0, const float* bx1, const float* by1, int n, float& t)
+{
+	// The usual handful of grid candidates isn't worth waking the wide units
+	if(n < 8)
+		return first_box_hit_scalar(x0, y0, x1, y1, bx0, by0, bx1, by1, n, t);
+	if(collide_kernel == NULL)
+		collide_isa();
+	return collide_kernel(x0, y0, x1, y1, bx0, by0, bx1, by1, n, t);
+}
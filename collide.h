@@ -0,0 +1,33 @@
+#ifndef COLLIDE_H
+#define COLLIDE_H
+
+/* Segment against box tests, batched over boxes kept as structure-of-arrays
+   (min x, min y, max x, max y each in its own array). The batch kernels
+   come in scalar, SSE2 and AVX2 versions; the widest one the CPU supports
+   is picked at run time. All versions give bit-identical results, so a
+   replay plays out the same on every machine */
+
+enum CollideIsa {
+	COLLIDE_SCALAR,
+	COLLIDE_SSE2,
+	COLLIDE_AVX2
+};
+
+/* Time of impact of the segment (x0,y0)-(x1,y1) with one box. On a hit t is
+   the fraction of the way along the segment where it first touches the box,
+   0 if it starts inside */
+bool segment_box_toi (float x0, float y0, float x1, float y1, float bx0, float by0, float bx1, float by1, float& t);
+
+/* Index of the box the segment touches first, or -1 if it misses all n.
+   Ties go to the lowest index. t is set as in segment_box_toi on a hit */
+int first_box_hit (float x0, float y0, float x1, float y1,
+                   const float* bx0, const float* by0, const float* bx1, const float* by1, int n, float& t);
+
+/* Kernel first_box_hit uses. collide_select returns false and keeps the
+   current one if the CPU can't run the requested ISA */
+CollideIsa collide_isa ();
+bool collide_select (CollideIsa isa);
+bool collide_supported (CollideIsa isa);
+const char* collide_isa_name (CollideIsa isa);
+
+#endif
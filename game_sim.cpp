@@ -0,0 +1,999 @@
+#include <iostream>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <deque>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "game_sim.h"
+#include "collide.h"
+#include "jobs.h"
+#include "timers.h"
+#include "profile.h"
+
+using namespace std;
+
+EntityStore Gun;
+EntityStore Brick;
+EntityStore Basket;
+EntityStore Laser;
+EntityStore Mirror;
+EntityStore Line;
+
+EntityHandle gun_base, gun_barrel, gun_hub;
+EntityHandle red_basket, red_rim, green_basket, green_rim;
+EntityHandle divider_line;
+EntityHandle loaded_laser;
+
+/* Return a zero-initialised slot, recycling a released one when available */
+EntityHandle store_add (EntityStore& store)
+{
+	if(!store.free_slots.empty()){
+		int i = store.free_slots.back();
+		store.free_slots.pop_back();
+		store.color[i] = Color();
+		store.status[i] = 0;
+		store.flag[i] = 0;
+		store.x[i] = 0;
+		store.y[i] = 0;
+		store.speed[i] = 0;
+		store.len[i] = 0;
+		store.breadth[i] = 0;
+		store.radius[i] = 0;
+		store.angle[i] = 0;
+		store.prev_x[i] = 0;
+		store.prev_y[i] = 0;
+		store.prev_angle[i] = 0;
+
+		EntityHandle handle = { i, store.generation[i] };
+		return handle;
+	}
+
+	store.object.push_back(NULL);
+	store.color.push_back(Color());
+	store.status.push_back(0);
+	store.flag.push_back(0);
+	store.x.push_back(0);
+	store.y.push_back(0);
+	store.speed.push_back(0);
+	store.len.push_back(0);
+	store.breadth.push_back(0);
+	store.radius.push_back(0);
+	store.angle.push_back(0);
+	store.prev_x.push_back(0);
+	store.prev_y.push_back(0);
+	store.prev_angle.push_back(0);
+	store.generation.push_back(0);
+
+	EntityHandle handle = { store.count, 0 };
+	store.count++;
+	return handle;
+}
+
+/* Mark the slot dead and put it on the free list.
+   Bumping the generation invalidates every handle still pointing at it */
+void store_release (EntityStore& store, int i)
+{
+	if(store.flag[i] == -1)
+		return;
+	store.flag[i] = -1;
+	store.generation[i]++;
+	store.free_slots.push_back(i);
+	geometry_release(store.object[i]);
+	store.object[i] = NULL;
+}
+
+/* True while the slot the handle points at has not been reused */
+bool store_valid (const EntityStore& store, EntityHandle handle)
+{
+	return handle.index >= 0 && handle.index < store.count && store.generation[handle.index] == handle.generation;
+}
+
+/* Remember where everything was before the tick moves it */
+void store_snapshot (EntityStore& store)
+{
+	store.prev_x = store.x;
+	store.prev_y = store.y;
+	store.prev_angle = store.angle;
+}
+
+/* Value between the previous and the current tick, alpha in [0,1] */
+float lerp (float prev, float current, float alpha)
+{
+	return prev + (current - prev)*alpha;
+}
+
+float red_basket_trans_dir;
+float green_basket_trans_dir;
+bool red_basket_trans_status = false;
+bool green_basket_trans_status = false;
+float gun_trans_dir;
+bool gun_trans_status = false;
+float gun_rot_dir;
+bool gun_rot_status = false;
+float brick_speed = 0.05;
+int laser_trans_status = 0;
+float red_basket_translation = -2.0f;
+float green_basket_translation = 2.0f;
+float gun_rotation = 0;
+float gun_translation = 0;
+float x_intersection,y_intersection;
+int points = 0,misfire=0;
+
+double sim_time = 0;
+long sim_ticks = 0;
+
+/* Timed game rules run off a timer wheel on the simulation clock instead of
+   being polled every tick */
+#define BRICK_SPAWN_TICKS (2*SIM_HZ)
+#define BRICKDOWN_TICKS (SIM_HZ/20)
+#define LASER_RELOAD_TICKS SIM_HZ
+
+TimerWheel game_timers;
+
+Rng game_rng;
+
+void rng_seed (Rng& rng, uint64_t seed, uint64_t stream)
+{
+	rng.state = 0;
+	rng.inc = (stream << 1) | 1;
+	rng_next(rng);
+	rng.state += seed;
+	rng_next(rng);
+}
+
+uint32_t rng_next (Rng& rng)
+{
+	uint64_t old = rng.state;
+	rng.state = old*6364136223846793005ULL + rng.inc;
+	uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+	uint32_t rot = (uint32_t)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/* Uniform in [0,1), from the top 24 bits so every value is exact */
+float rng_float (Rng& rng)
+{
+	return (rng_next(rng) >> 8) * (1.0f/16777216.0f);
+}
+
+/* Uniform in [0,n) without modulo bias (Lemire's multiply and reject) */
+uint32_t rng_range (Rng& rng, uint32_t n)
+{
+	uint64_t m = (uint64_t)rng_next(rng) * n;
+	uint32_t low = (uint32_t)m;
+	if(low < n){
+		uint32_t threshold = (-n) % n;
+		while(low < threshold){
+			m = (uint64_t)rng_next(rng) * n;
+			low = (uint32_t)m;
+		}
+	}
+	return (uint32_t)(m >> 32);
+}
+
+EntityHandle createRectangle (EntityStore& store, Color Color, float l, float b, float x, float y,float angle)
+{
+	EntityHandle handle = store_add(store);
+	int i = handle.index;
+	store.object[i] = rectangleGeometry(l, b);
+	store.x[i] = x;
+	store.y[i] = y;
+	store.len[i] = 2*l;
+	store.breadth[i] = 2*b;
+	store.color[i] = Color;
+	store.angle[i] = angle;
+	store.prev_x[i] = x;
+	store.prev_y[i] = y;
+	store.prev_angle[i] = angle;
+	return handle;
+}
+
+void rectangleVertices (float l, float b, float* vertices)
+{
+	const float vertex_buffer_data [] = {
+		-l,-b,0,
+		l,-b,0,
+		l,b,0,
+
+		l,b,0,
+		-l,b,0,
+		-l,-b,0
+	};
+	memcpy(vertices, vertex_buffer_data, sizeof(vertex_buffer_data));
+}
+
+void circleVertices (float radius, float* vertices)
+{
+	rectangleVertices(radius, radius, vertices);
+}
+
+EntityHandle createCircle (EntityStore& store, Color Color, float radius, float x, float y,float parts)
+{
+	EntityHandle handle = store_add(store);
+	int i = handle.index;
+	store.object[i] = circleGeometry(radius, parts);
+	store.x[i] = x;
+	store.y[i] = y;
+	store.radius[i] = radius;
+	store.color[i] = Color;
+	store.prev_x[i] = x;
+	store.prev_y[i] = y;
+	return handle;
+}
+
+/* Live bricks ordered by height, lowest first. Bricks only move by all
+   falling together in brickdown(), so a brick keeps its place from spawn to
+   release and height band queries can binary search the list. New bricks
+   join at the top and most leave from near the bottom, at the floor, in the
+   baskets or to lasers fired from below, and a deque erases near either end
+   without moving the rest */
+deque<int> brick_height_order;
+vector<int> brick_band_hits;
+
+bool brick_below (int b, double y)
+{
+	return Brick.y[b] < y;
+}
+
+bool brick_above (double y, int b)
+{
+	return y < Brick.y[b];
+}
+
+void brick_order_insert (int b)
+{
+	brick_height_order.insert(upper_bound(brick_height_order.begin(), brick_height_order.end(), (double)Brick.y[b], brick_above), b);
+}
+
+/* Release a brick and take it out of the height order */
+void brick_release (int b)
+{
+	deque<int>::iterator it = lower_bound(brick_height_order.begin(), brick_height_order.end(), (double)Brick.y[b], brick_below);
+	while(it != brick_height_order.end() && *it != b && Brick.y[*it] == Brick.y[b])
+		it++;
+	if(it != brick_height_order.end() && *it == b)
+		brick_height_order.erase(it);
+	store_release(Brick, b);
+}
+
+/* Collect the bricks with low <= y <= high into brick_band_hits, in slot
+   order so they resolve in the same order as a full scan */
+void brick_band (double low, double high)
+{
+	brick_band_hits.clear();
+	deque<int>::iterator it = lower_bound(brick_height_order.begin(), brick_height_order.end(), low, brick_below);
+	for(; it != brick_height_order.end() && Brick.y[*it] <= high; it++)
+		brick_band_hits.push_back(*it);
+	sort(brick_band_hits.begin(), brick_band_hits.end());
+}
+
+void brickdraw ()
+{
+	Color black = {0,0,0};
+	Color green = {0,1,0};
+	Color red = {1,0,0};
+	map<int,Color> colormap;
+	colormap[0] = black;
+	colormap[1] = red;
+	colormap[2] = green;
+	float x = rng_float(game_rng)*5-2.5;
+	int clr = rng_range(game_rng, 3);
+	EntityHandle brick = createRectangle(Brick,colormap[clr],0.08,0.18,x,4.0,0);
+	brick_order_insert(brick.index);
+}
+
+int intersect_point(Point p1,Point p2,Point p4,Point p5){
+  float x0=p1.x, y0=p1.y,x1=p2.x, y1=p2.y;int i;
+// Point p3;
+
+    float s1_x, s1_y, s2_x, s2_y, x2=p4.x, y2=p4.y, x3=p5.x, y3=p5.y, q, p, r;
+
+    s1_x = x1 - x0;
+    s1_y = y1 - y0;
+    s2_x = x3 - x2;
+    s2_y = y3 - y2;
+
+    r=s1_x*s2_y - s2_x*s1_y;
+    if(r==0){
+      // p3.va=0;
+      return 0;
+    }
+
+    p = (s1_x*(y0-y2) - s1_y*(x0-x2))/(r*1.0f);
+    q = (s2_x*(y0-y2) - s2_y*(x0-x2))/(r*1.0f);
+
+    if (p>=0 && p<=1 && q>=0 && q<=1)
+    {
+        x_intersection = x0 + (q * s1_x);
+        y_intersection = y0 + (q * s1_y);
+        // p3.va=1;
+        return 1;
+    }
+    // p3.va=0;
+    return 0;
+}
+
+vector<MirrorGeometry> mirror_geometry;
+bool mirror_geometry_dirty = true;
+// Bumped on every rebake, so laser paths traced against older mirrors show up
+unsigned int mirror_geometry_version = 0;
+
+void mirror_geometry_invalidate ()
+{
+	mirror_geometry_dirty = true;
+}
+
+void mirror_geometry_update ()
+{
+	if(!mirror_geometry_dirty && (int)mirror_geometry.size() == Mirror.count)
+		return;
+	mirror_geometry.resize(Mirror.count);
+	for(int m=0;m<Mirror.count;m++){
+		MirrorGeometry& g = mirror_geometry[m];
+		g.x0 = Mirror.x[m] + (Mirror.len[m]/2)*cos((Mirror.angle[m]*M_PI/180.0f));
+		g.y0 = Mirror.y[m] + (Mirror.len[m]/2)*sin((Mirror.angle[m]*M_PI/180.0f));
+		g.x1 = Mirror.x[m] - (Mirror.len[m]/2)*cos((Mirror.angle[m]*M_PI/180.0f));
+		g.y1 = Mirror.y[m] - (Mirror.len[m]/2)*sin((Mirror.angle[m]*M_PI/180.0f));
+		g.nx = g.y1 - g.y0;
+		g.ny = -(g.x1 - g.x0);
+		g.cos2 = cos((2*Mirror.angle[m]*M_PI/180.0f));
+		g.sin2 = sin((2*Mirror.angle[m]*M_PI/180.0f));
+		g.twice_angle = 2*Mirror.angle[m];
+	}
+	mirror_geometry_dirty = false;
+	mirror_geometry_version++;
+}
+
+/* Distance s along the ray from (x,y) in unit direction (dx,dy) at which it
+   meets a mirror, by dot products with the baked edge normal. Only hits in
+   front of the ray count */
+bool mirror_ray (const MirrorGeometry& g, float x, float y, float dx, float dy, float& s)
+{
+	float r = g.nx*dx + g.ny*dy;
+	if(r == 0)
+		return false;
+	float wx = x - g.x0, wy = y - g.y0;
+	s = -(g.nx*wx + g.ny*wy)/r;
+	float u = -(wx*dy - wy*dx)/r;   // how far along the mirror, 0 to 1
+	return s > 0 && u >= 0 && u <= 1;
+}
+
+bool checkintersection (float x1 , float y1,float x2, float y2, float x3, float y3, float x4 , float y4)
+{
+  bool statement = ( (
+                        ((y3-y1)*(x2-x1)-(y2-y1)*(x3-x1))*
+                        ((y4-y1)*(x2-x1)-(y2-y1)*(x4-x1)) < 0
+                     ) &&
+                     (
+                       ((y1-y3)*(x4-x3)-(y4-y3)*(x1-x3))*
+                       ((y2-y3)*(x4-x3)-(y4-y3)*(x2-x3)) < 0
+                     )
+                   );
+  if (statement)
+  {
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+bool brick_coll_basket (int baskt, int brck)
+{
+	if(Brick.y[brck]<=-2.4 && Brick.y[brck]>=-2.5 ){
+	if( Brick.x[brck] >= Basket.x[baskt]-(Basket.len[baskt]/2 - Brick.len[brck]/2) && Brick.x[brck] <= Basket.x[baskt]+(Basket.len[baskt]/2 - Brick.len[brck]/2))
+		return true;}
+	return false;
+}
+
+/* The tick's passes run as jobs over slot ranges of these sizes. A pass
+   that fits in one chunk runs straight on the calling thread */
+#define JOB_LASER_GRAIN 256
+#define JOB_BRICK_GRAIN 8192
+
+JobGraph tick_jobs;
+
+void brickdown_range (void* /*data*/, int begin, int end, int /*worker*/)
+{
+	PROFILE_SCOPE("brickdown");
+	for(int i=begin;i<end;i++)
+		Brick.y[i] = Brick.y[i] - brick_speed;
+}
+
+void brickdown()
+{
+	job_clear(tick_jobs);
+	job_add_range(tick_jobs, brickdown_range, NULL, Brick.count, JOB_BRICK_GRAIN);
+	jobs_run(tick_jobs, Brick.count > JOB_BRICK_GRAIN);
+}
+
+/* Uniform grid over the play area, used as the broadphase for laser/brick
+   hits. Every live brick is filed in each cell its box overlaps and only
+   moves between cells when its box crosses a cell edge. A laser looks only
+   at the bricks filed in the cells under its own bounding box */
+#define GRID_MIN -4.5f
+#define GRID_CELL 0.5f
+#define GRID_DIM 18
+
+vector<int> grid_cells[GRID_DIM*GRID_DIM];
+// Cell range each brick slot is filed under; grid_x0 is -1 while unfiled
+vector<int> grid_x0, grid_y0, grid_x1, grid_y1;
+// A brick is smaller than a cell, so its box overlaps at most 2x2 cells
+#define GRID_BRICK_CELLS 4
+// Where each brick sits in each cell of its range, row by row, so taking it
+// out of a cell needs no search
+vector<int> grid_pos;
+
+/* Scratch for one laser's brick query; every job worker has its own */
+struct BrickQuery {
+	vector<unsigned int> stamp;
+	unsigned int query;
+	vector<int> hits;
+	// Boxes of the live bricks in hits, laid out for first_box_hit
+	vector<float> x0, y0, x1, y1;
+	vector<int> slot;
+};
+vector<BrickQuery> brick_queries;
+
+// Where each laser's tail was before it moved this tick, and the leg of its
+// path the tail was on
+vector<float> sweep_x, sweep_y;
+vector<int> sweep_leg;
+// Lasers that left the play area, and the brick each laser hit this tick
+vector<char> laser_left;
+vector<int> laser_hit;
+
+/* Lasers fly straight between mirrors, so the whole flight is known the
+   moment one is fired: a chain of legs, each starting at a bounce. The
+   laser's position on any tick is read off the chain by time */
+#define LASER_BOUNCE_SPEED 0.18
+// Enough for any real flight; two facing mirrors could bounce forever
+#define LASER_PATH_MAX_BOUNCES 16
+
+struct PathLeg {
+	float x, y;       // where the leg starts
+	float dx, dy;     // unit direction
+	float angle;
+	double start;     // distance along the path at which the leg starts
+	int mirror;       // mirror the leg leaves from, -1 for the first leg
+};
+typedef struct PathLeg PathLeg;
+
+struct LaserPath {
+	vector<PathLeg> legs;
+	int leg;                    // leg the laser is on
+	long start_tick;            // tick the path starts at
+	float speed;                // speed up to the first mirror
+	unsigned int generation;    // laser slot generation it was traced for
+	unsigned int version;       // mirror_geometry_version it was traced against, 0 for none
+};
+typedef struct LaserPath LaserPath;
+
+vector<LaserPath> laser_paths;
+
+int grid_cell (float v)
+{
+	int c = (int)floor((v - GRID_MIN)/GRID_CELL);
+	return c < 0 ? 0 : c >= GRID_DIM ? GRID_DIM-1 : c;
+}
+
+/* Slot in grid_pos for cell (cx,cy) of the range brick b is filed under */
+int grid_pos_slot (int b, int cx, int cy)
+{
+	return b*GRID_BRICK_CELLS + (cy - grid_y0[b])*(grid_x1[b] - grid_x0[b] + 1) + (cx - grid_x0[b]);
+}
+
+/* Add brick b to the cells of a range, or take it out of the range it is
+   filed under. Removal moves the cell's last brick into the hole */
+void grid_file (int b, int x0, int y0, int x1, int y1, bool add)
+{
+	int k = b*GRID_BRICK_CELLS;
+	for(int cy=y0;cy<=y1;cy++)
+		for(int cx=x0;cx<=x1;cx++,k++){
+			vector<int>& cell = grid_cells[cy*GRID_DIM + cx];
+			if(add){
+				grid_pos[k] = (int)cell.size();
+				cell.push_back(b);
+			}
+			else{
+				int at = grid_pos[k], last = cell.back();
+				cell[at] = last;
+				grid_pos[grid_pos_slot(last, cx, cy)] = at;
+				cell.pop_back();
+			}
+		}
+}
+
+/* Bring the grid in line with the brick store: file new bricks, move the
+   ones that crossed a cell edge and drop released ones */
+void grid_update ()
+{
+	if((int)grid_x0.size() < Brick.count){
+		grid_x0.resize(Brick.count, -1);
+		grid_y0.resize(Brick.count);
+		grid_x1.resize(Brick.count);
+		grid_y1.resize(Brick.count);
+		grid_pos.resize(Brick.count*GRID_BRICK_CELLS);
+	}
+	for(int b=0;b<Brick.count;b++){
+		int x0 = -1, y0 = 0, x1 = 0, y1 = 0;
+		if(Brick.flag[b] != -1){
+			x0 = grid_cell(Brick.x[b] - Brick.len[b]/2);
+			x1 = grid_cell(Brick.x[b] + Brick.len[b]/2);
+			y0 = grid_cell(Brick.y[b] - Brick.breadth[b]/2);
+			y1 = grid_cell(Brick.y[b] + Brick.breadth[b]/2);
+		}
+		if(x0 == grid_x0[b] && y0 == grid_y0[b] && x1 == grid_x1[b] && y1 == grid_y1[b])
+			continue;
+		if(grid_x0[b] != -1)
+			grid_file(b, grid_x0[b], grid_y0[b], grid_x1[b], grid_y1[b], false);
+		if(x0 != -1)
+			grid_file(b, x0, y0, x1, y1, true);
+		grid_x0[b] = x0;
+		grid_y0[b] = y0;
+		grid_x1[b] = x1;
+		grid_y1[b] = y1;
+	}
+}
+
+/* Collect the bricks filed under a box into q.hits, each once and in
+   slot order so hits resolve in the same order as a full scan */
+void grid_gather (BrickQuery& q, float xmin, float ymin, float xmax, float ymax)
+{
+	if((int)q.stamp.size() < Brick.count)
+		q.stamp.resize(Brick.count, 0);
+	q.hits.clear();
+	q.query++;
+	int x0 = grid_cell(xmin), x1 = grid_cell(xmax);
+	int y0 = grid_cell(ymin), y1 = grid_cell(ymax);
+	for(int cy=y0;cy<=y1;cy++)
+		for(int cx=x0;cx<=x1;cx++){
+			const vector<int>& cell = grid_cells[cy*GRID_DIM + cx];
+			for(size_t i=0;i<cell.size();i++){
+				int b = cell[i];
+				if(q.stamp[b] != q.query){
+					q.stamp[b] = q.query;
+					q.hits.push_back(b);
+				}
+			}
+		}
+	sort(q.hits.begin(), q.hits.end());
+}
+
+void laser_scratch_fit ()
+{
+	if((int)sweep_x.size() < Laser.count){
+		sweep_x.resize(Laser.count);
+		sweep_y.resize(Laser.count);
+		sweep_leg.resize(Laser.count);
+		laser_left.resize(Laser.count);
+		laser_hit.resize(Laser.count, -1);
+		laser_paths.resize(Laser.count);
+	}
+}
+
+/* First live brick on the segment from (x0,y0) to (x1,y1), or -1 */
+int segment_first_brick (BrickQuery& q, float x0, float y0, float x1, float y1)
+{
+	grid_gather(q, min(x0,x1), min(y0,y1), max(x0,x1), max(y0,y1));
+	q.x0.clear();
+	q.y0.clear();
+	q.x1.clear();
+	q.y1.clear();
+	q.slot.clear();
+	for(size_t h=0;h<q.hits.size();h++)
+	{
+		int b = q.hits[h];
+		if(Brick.flag[b] == -1)
+			continue;
+		q.x0.push_back(Brick.x[b]-Brick.len[b]/2);
+		q.y0.push_back(Brick.y[b]-Brick.breadth[b]/2);
+		q.x1.push_back(Brick.x[b]+Brick.len[b]/2);
+		q.y1.push_back(Brick.y[b]+Brick.breadth[b]/2);
+		q.slot.push_back(b);
+	}
+	float t;
+	int first = first_box_hit(x0, y0, x1, y1, q.x0.data(), q.y0.data(), q.x1.data(), q.y1.data(), (int)q.slot.size(), t);
+	return first == -1 ? -1 : q.slot[first];
+}
+
+/* First live brick on laser l's sweep this tick, or -1. A laser that
+   bounced since the last tick sweeps each leg it covered up to its mirror
+   before the leg it is on now, so the brick it meets first wins */
+int laser_first_brick (int l, BrickQuery& q)
+{
+	const LaserPath& path = laser_paths[l];
+	float x0 = sweep_x[l], y0 = sweep_y[l];
+	for(int leg=sweep_leg[l];leg<path.leg;leg++){
+		const PathLeg& bounce = path.legs[leg+1];
+		int hit = segment_first_brick(q, x0, y0, bounce.x, bounce.y);
+		if(hit != -1)
+			return hit;
+		x0 = bounce.x;
+		y0 = bounce.y;
+	}
+	float theta = (Laser.angle[l]*M_PI/180.0f);
+	float x1 = Laser.x[l]+(Laser.len[l]/2)*cos(theta), y1 = Laser.y[l]+(Laser.len[l]/2)*sin(theta);
+	return segment_first_brick(q, x0, y0, x1, y1);
+}
+
+/* Trace laser l from where it is now through the mirrors. The path starts
+   this tick and is read back by time from then on */
+void laser_path_build (int l)
+{
+	LaserPath& path = laser_paths[l];
+	// A laser sitting on a mirror it just left must not bounce off it again
+	int from = path.version != 0 && path.generation == Laser.generation[l] ? path.legs[path.leg].mirror : -1;
+	path.legs.clear();
+	path.leg = 0;
+	path.start_tick = sim_ticks;
+	path.speed = Laser.speed[l];
+	path.generation = Laser.generation[l];
+	path.version = mirror_geometry_version;
+
+	float x = Laser.x[l], y = Laser.y[l], angle = Laser.angle[l];
+	float dx = cos((angle*M_PI/180.0f)), dy = sin((angle*M_PI/180.0f));
+	double start = 0;
+	for(int bounce=0;;bounce++){
+		PathLeg leg = { x, y, dx, dy, angle, start, from };
+		path.legs.push_back(leg);
+		if(bounce == LASER_PATH_MAX_BOUNCES)
+			break;
+		int hit = -1;
+		float nearest = 0;
+		for(int m=0;m<(int)mirror_geometry.size();m++){
+			float d;
+			if(m != from && mirror_ray(mirror_geometry[m], x, y, leg.dx, leg.dy, d) && (hit == -1 || d < nearest)){
+				hit = m;
+				nearest = d;
+			}
+		}
+		if(hit == -1)
+			break;
+		// Bounce by the baked reflection matrix; only the first leg needs trig
+		const MirrorGeometry& g = mirror_geometry[hit];
+		x += nearest*dx;
+		y += nearest*dy;
+		float rx = g.cos2*dx + g.sin2*dy;
+		dy = g.sin2*dx - g.cos2*dy;
+		dx = rx;
+		angle = g.twice_angle - angle;
+		start += nearest;
+		from = hit;
+	}
+}
+
+/* How far along its path a laser is after k ticks. It keeps its firing
+   speed up to the first mirror and goes at the bounce speed after that */
+double laser_path_distance (const LaserPath& path, double k)
+{
+	double s = k*path.speed;
+	if(path.legs.size() > 1 && s > path.legs[1].start)
+		s = path.legs[1].start + (k - path.legs[1].start/path.speed)*LASER_BOUNCE_SPEED;
+	return s;
+}
+
+void laser_move_range (void* /*data*/, int begin, int end, int /*worker*/)
+{
+	PROFILE_SCOPE("laser move");
+	for(int i=begin;i<end;i++)
+	{
+		laser_left[i] = 0;
+		if(Laser.flag[i] == -1 || Laser.status[i] != 1)
+			continue;
+		LaserPath& path = laser_paths[i];
+		if(path.version != mirror_geometry_version || path.generation != Laser.generation[i])
+			laser_path_build(i);
+
+		double k = sim_ticks + 1 - path.start_tick;
+		double s = laser_path_distance(path, k), before = laser_path_distance(path, k-1);
+		int leg = path.leg;
+		while(leg+1 < (int)path.legs.size() && path.legs[leg+1].start <= s)
+			leg++;
+		const PathLeg& at = path.legs[leg];
+		if(leg != path.leg){
+			path.leg = leg;
+			Laser.speed[i] = LASER_BOUNCE_SPEED;
+			// Turn sharply at the mirror instead of sweeping through the bounce
+			Laser.prev_angle[i] = at.angle;
+		}
+		Laser.angle[i] = at.angle;
+		Laser.x[i] = at.x + (s - at.start)*at.dx;
+		Laser.y[i] = at.y + (s - at.start)*at.dy;
+
+		// The sweep starts at the tail a tick ago, on whichever leg it was
+		double tail = before - Laser.len[i]/2;
+		int tail_leg = leg;
+		while(tail_leg > 0 && path.legs[tail_leg].start > tail)
+			tail_leg--;
+		const PathLeg& from = path.legs[tail_leg];
+		sweep_leg[i] = tail_leg;
+		sweep_x[i] = from.x + (tail - from.start)*from.dx;
+		sweep_y[i] = from.y + (tail - from.start)*from.dy;
+		// Lasers that left the play area can never hit anything again
+		laser_left[i] = fabs(Laser.x[i]) > 4.5 || fabs(Laser.y[i]) > 4.5;
+	}
+}
+
+void grid_update_job (void* /*data*/, int /*begin*/, int /*end*/, int /*worker*/)
+{
+	PROFILE_SCOPE("grid update");
+	grid_update();
+}
+
+/* A laser sweeps along its path from where its tail was before it moved to
+   where its head is now, so it can't step over a brick between ticks, not
+   even one just short of a mirror it bounced off. It hits the first
+   brick box along that sweep, whichever side it comes in from */
+void laser_query_range (void* /*data*/, int begin, int end, int worker)
+{
+	PROFILE_SCOPE("laser query");
+	for(int l=begin;l<end;l++)
+	{
+		laser_hit[l] = -1;
+		if(Laser.status[l] == 0 || Laser.flag[l] == -1 || laser_left[l])
+			continue;
+		laser_hit[l] = laser_first_brick(l, brick_queries[worker]);
+	}
+}
+
+void spawn_timer (void* /*data*/)
+{
+	brickdraw();
+	timer_schedule(game_timers, sim_ticks + BRICK_SPAWN_TICKS, spawn_timer, NULL);
+}
+
+void brickdown_timer (void* /*data*/)
+{
+	brickdown();
+	timer_schedule(game_timers, sim_ticks + BRICKDOWN_TICKS, brickdown_timer, NULL);
+}
+
+void reload_timer (void* /*data*/)
+{
+	if(store_valid(Laser, loaded_laser) && Laser.status[loaded_laser.index] == 0)
+		return;
+	Color red = {1,0,0};
+	loaded_laser = createRectangle(Laser,red,0.15,0.04,-3.6,gun_translation,0);
+	Laser.speed[loaded_laser.index] = 0.11;
+	laser_scratch_fit();
+}
+
+void game_reset ()
+{
+	// From the top, so the height order shrinks from its end
+	while(!brick_height_order.empty())
+		brick_release(brick_height_order.back());
+	for(int l=0;l<Laser.count;l++)
+		if(l != loaded_laser.index)
+			store_release(Laser, l);
+	points = 0;
+	misfire = 0;
+}
+
+void fireLaser (float angle)
+{
+	if(!store_valid(Laser, loaded_laser) || Laser.status[loaded_laser.index] != 0)
+		return;
+	Laser.angle[loaded_laser.index] = angle;
+	Laser.status[loaded_laser.index] = 1;
+	timer_schedule(game_timers, sim_ticks + LASER_RELOAD_TICKS, reload_timer, NULL);
+}
+
+void tick ()
+{
+  PROFILE_SCOPE("tick");
+  store_snapshot(Gun);
+  store_snapshot(Brick);
+  store_snapshot(Basket);
+  store_snapshot(Laser);
+
+  // Spawns, reloads and the bricks' descent that are due now
+  {
+	  PROFILE_SCOPE("timers");
+	  timer_advance(game_timers, sim_ticks);
+  }
+
+  {
+	  PROFILE_SCOPE("gun");
+	  for(int i=0;i<Gun.count;i++)
+	  {
+		  Gun.y[i] = gun_translation;
+		  // The barrel and hub turn about their own centres, the base stays put
+		  if(i != gun_base.index)
+			  Gun.angle[i] = gun_rotation;
+	  }
+  }
+
+  {
+	  PROFILE_SCOPE("bricks");
+	  for(int i=0;i<Brick.count;i++)
+	  {
+		  if(Brick.flag[i] == -1)
+		  	continue;
+		  if(Brick.y[i] <= -4.18){
+		  	points-=2;
+			brick_release(i);
+		  }
+	  }
+  }
+
+  Basket.x[red_basket.index] = Basket.x[red_rim.index] = red_basket_translation;
+  Basket.x[green_basket.index] = Basket.x[green_rim.index] = green_basket_translation;
+
+  laser_scratch_fit();
+  if((int)brick_queries.size() < jobs_workers())
+	  brick_queries.resize(jobs_workers());
+
+  // Only the loaded laser waits at the gun; it goes when fired
+  if(store_valid(Laser, loaded_laser) && Laser.status[loaded_laser.index] == 0){
+	 int i = loaded_laser.index;
+	 Laser.y[i] = gun_translation;
+	 if(laser_trans_status == 1)
+	 	 fireLaser(Laser.angle[i]);
+	 else
+	 	 Laser.angle[i] = gun_rotation;
+  }
+
+  /* Lasers move along their paths and look for the first brick on their
+     sweep, each independently of the others, while the grid catches up with
+     the bricks. Anything that releases slots or scores runs on this thread
+     afterwards, in slot order, so the free lists and the score come out the
+     same whatever the thread count; it also keeps geometry_release, which
+     may free GL objects, off the workers */
+  {
+	  PROFILE_SCOPE("mirrors");
+	  mirror_geometry_update();
+  }
+  {
+	  PROFILE_SCOPE("collision");
+	  job_clear(tick_jobs);
+	  int grid_job = job_add(tick_jobs, grid_update_job, NULL, 0, Brick.count);
+	  int move_jobs = job_add_range(tick_jobs, laser_move_range, NULL, Laser.count, JOB_LASER_GRAIN);
+	  int query_jobs = job_add_range(tick_jobs, laser_query_range, NULL, Laser.count, JOB_LASER_GRAIN);
+	  for(int c=0;query_jobs+c<(int)tick_jobs.jobs.size();c++){
+		  job_after(tick_jobs, query_jobs+c, grid_job);
+		  job_after(tick_jobs, query_jobs+c, move_jobs+c);
+	  }
+	  jobs_run(tick_jobs, Laser.count > JOB_LASER_GRAIN);
+	  for(int i=0;i<Laser.count;i++)
+		 if(laser_left[i])
+		 	store_release(Laser, i);
+  }
+
+  laser_trans_status = 0;
+
+  /* Score the hits in laser order. A brick an earlier laser already took
+     sends the laser looking again, which gives what a one-laser-at-a-time
+     pass would have */
+  {
+	  PROFILE_SCOPE("scoring");
+	  for(int l=0;l<Laser.count;l++)
+	  {
+		  int hit = laser_hit[l];
+		  if(hit == -1)
+		  	continue;
+		  if(Brick.flag[hit] == -1)
+			  hit = laser_first_brick(l, brick_queries[0]);
+		  if(hit == -1)
+		  	continue;
+		  store_release(Laser, l);
+		  brick_release(hit);
+		  if(Brick.color[hit].r==0 && Brick.color[hit].g==0 && Brick.color[hit].b==0 ){
+			  points+=10;
+		  }
+		  else{
+			  points-=2;
+			  misfire++;
+			  if(misfire==5){
+				  cout << points << endl;
+				  exit(0);
+			  }
+		  }
+	  }
+  }
+
+  // Only bricks inside the catch band of brick_coll_basket can be caught
+  {
+	  PROFILE_SCOPE("baskets");
+	  bool check;
+	  brick_band(-2.5, -2.4);
+	  for(int k=0;k<Basket.count;k++)
+	  {
+		  for(size_t h=0;h<brick_band_hits.size();h++)
+		  {
+			  int b = brick_band_hits[h];
+			  if(Brick.flag[b] == -1)
+				continue;
+			  check = brick_coll_basket(k,b);
+			  if(check == true){
+				 	brick_release(b);
+					if(Brick.color[b].r==0 && Brick.color[b].g==0 && Brick.color[b].b==0 ){
+						cout << points << endl;
+						exit(0);
+					}
+					else if(Brick.color[b].r==1 && Brick.color[b].g==0 && Brick.color[b].b==0 && Basket.color[k].r==1 && Basket.color[k].g==0 && Basket.color[k].b==0)
+						points+=5;
+					else if(Brick.color[b].r==0 && Brick.color[b].g==1 && Brick.color[b].b==0 && Basket.color[k].r==0 && Basket.color[k].g==1 && Basket.color[k].b==0)
+						points+=5;
+					else                              //bricks collected in wrong baskets
+						points-=2;
+				}
+		  }
+	  }
+  }
+  // Increment angles
+  float increments = 1;
+
+  //camera_rotation_angle++; // Simulating camera rotation
+  // triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
+  red_basket_translation = red_basket_translation + red_basket_trans_dir*red_basket_trans_status;
+  green_basket_translation = green_basket_translation + green_basket_trans_dir*green_basket_trans_status;
+  gun_translation = gun_translation + gun_trans_dir*gun_trans_status;
+  gun_rotation = gun_rotation + gun_rot_dir*gun_rot_status;
+  if(gun_rotation >= 60)
+  	gun_rotation = 60;
+  else if(gun_rotation <= -60)
+  	gun_rotation = -60;
+  if(gun_translation > 3.44f)
+  	gun_translation = 3.44f;
+  else if(gun_translation < -1.64f)
+  	gun_translation = -1.64f;
+  if(green_basket_translation>3.4f)
+  	green_basket_translation = 3.4f;
+  else if(green_basket_translation < -3.4f)
+  	green_basket_translation = -3.4f;
+  if(red_basket_translation > 3.4f)
+  	red_basket_translation = 3.4f;
+  else if(red_basket_translation < -3.4f)
+  	red_basket_translation = -3.4f;
+
+  sim_time += SIM_DT;
+  sim_ticks++;
+}
+
+void initGame (uint64_t seed)
+{
+	rng_seed(game_rng, seed);
+	timer_wheel_init(game_timers, sim_ticks - 1);
+	timer_schedule(game_timers, sim_ticks + BRICK_SPAWN_TICKS, spawn_timer, NULL);
+	timer_schedule(game_timers, sim_ticks + BRICKDOWN_TICKS, brickdown_timer, NULL);
+	// Pick the collision kernel here rather than racing for it from the jobs
+	collide_isa();
+
+	Color blue = {0,0,1};
+	Color green = {0,1,0};
+	Color red = {1,0,0};
+	Color grey = {168.0/255.0,168.0/255.0,168.0/255.0};
+	Color gold = {218.0/255.0,165.0/255.0,32.0/255.0};
+	Color yellow = {1,1,0};
+	Color skyblue = {132/255.0,217/255.0,245/255.0};
+	Color black = {0,0,0};
+	Color white = {255/255.0,255/255.0,255/255.0};
+
+	map<int,Color> colormap;
+	colormap[0] = black;
+	colormap[1] = red;
+	colormap[2] = green;
+	// createRectangle("gun1","Gun",black,0.35,0.2,-3.8,0,0);
+	gun_base = createCircle(Gun,black,0.56,-4.0,0,1);
+	gun_barrel = createRectangle(Gun,black,0.23,0.10,-3.4,0,0);
+	gun_hub = createCircle(Gun,red,0.09,-3.7f,0.0f,1);
+	loaded_laser = createRectangle(Laser,red,0.15,0.04,-3.6,0.0,0);
+	Laser.speed[loaded_laser.index] = 0.11;
+	red_basket = createRectangle(Basket,red,0.6,0.5,-3.0,-3.0,0);
+	red_rim = createCircle(Basket,grey,0.6,0.0,-2.5,1);
+	green_basket = createRectangle(Basket,green,0.6,0.5,3.0,-3.0,0);
+	green_rim = createCircle(Basket,grey,0.6,0.0,-2.5,1);
+	createRectangle(Mirror,white,0.45,0.04,2.8,2.5,120);
+	createRectangle(Mirror,white,0.45,0.04,-1.4,1.4,70);
+	createRectangle(Mirror,white,0.45,0.04,0.9,-1.4,60);
+	mirror_geometry_invalidate();
+	mirror_geometry_update();
+	divider_line = createRectangle(Line,black,7.0,0.01,0.0,-2.22,0);
+}
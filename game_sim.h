@@ -0,0 +1,172 @@
+#ifndef GAME_SIM_H
+#define GAME_SIM_H
+
+#include <vector>
+#include <cstdint>
+
+/* Game state and the fixed-step simulation that advances it. Nothing in
+   here touches GL or GLFW, so the same code runs with or without a window */
+
+struct VAO;
+
+struct Color {
+	float r;
+	float g;
+	float b;
+};
+typedef struct Color Color;
+
+struct Point {
+    float x;
+	float y;
+};
+typedef struct Point Point;
+
+/* Generational handle to a slot in an EntityStore */
+struct EntityHandle {
+	int index;
+	unsigned int generation;
+};
+typedef struct EntityHandle EntityHandle;
+
+/* Structure-of-arrays store for one kind of game object.
+   Every field lives in its own contiguous array indexed by slot,
+   so per-frame passes walk them linearly instead of doing string lookups */
+struct EntityStore {
+	std::vector<VAO*> object;
+	std::vector<Color> color;
+	std::vector<int> status;
+	std::vector<int> flag;
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> speed;
+	std::vector<float> len;
+	std::vector<float> breadth;
+	std::vector<float> radius;
+	std::vector<float> angle;
+	// Values at the previous simulation tick, for render interpolation
+	std::vector<float> prev_x;
+	std::vector<float> prev_y;
+	std::vector<float> prev_angle;
+	std::vector<unsigned int> generation;
+	std::vector<int> free_slots;
+	int count;
+};
+typedef struct EntityStore EntityStore;
+
+extern EntityStore Gun;
+extern EntityStore Brick;
+extern EntityStore Basket;
+extern EntityStore Laser;
+extern EntityStore Mirror;
+extern EntityStore Line;
+
+extern EntityHandle gun_base, gun_barrel, gun_hub;
+extern EntityHandle red_basket, red_rim, green_basket, green_rim;
+extern EntityHandle divider_line;
+extern EntityHandle loaded_laser;
+
+/* Player controls, set by the input callbacks and applied every tick */
+extern float red_basket_trans_dir;
+extern float green_basket_trans_dir;
+extern bool red_basket_trans_status;
+extern bool green_basket_trans_status;
+extern float gun_trans_dir;
+extern bool gun_trans_status;
+extern float gun_rot_dir;
+extern bool gun_rot_status;
+extern float brick_speed;
+extern int laser_trans_status;
+extern float red_basket_translation;
+extern float green_basket_translation;
+extern float gun_rotation;
+extern float gun_translation;
+extern int points,misfire;
+
+/* PCG32 generator (O'Neill, pcg-random.org). All game randomness comes from
+   game_rng, so a seed plus the same input gives the same game every run */
+struct Rng {
+	uint64_t state;
+	uint64_t inc;
+};
+typedef struct Rng Rng;
+
+#define GAME_DEFAULT_SEED 1
+
+extern Rng game_rng;
+
+void rng_seed (Rng& rng, uint64_t seed, uint64_t stream=0);
+uint32_t rng_next (Rng& rng);
+float rng_float (Rng& rng);
+uint32_t rng_range (Rng& rng, uint32_t n);
+
+/* The simulation advances in fixed ticks of SIM_DT seconds whatever the
+   refresh rate; each rendered frame interpolates between the last two ticks */
+#define SIM_HZ 60
+const double SIM_DT = 1.0/SIM_HZ;
+// Longest frame the accumulator catches up on, so a stall cannot snowball
+#define SIM_MAX_FRAME_TIME 0.25
+extern double sim_time;
+extern long sim_ticks;
+
+EntityHandle store_add (EntityStore& store);
+void store_release (EntityStore& store, int i);
+bool store_valid (const EntityStore& store, EntityHandle handle);
+void store_snapshot (EntityStore& store);
+float lerp (float prev, float current, float alpha);
+
+EntityHandle createRectangle (EntityStore& store, Color Color, float l, float b, float x, float y,float angle);
+EntityHandle createCircle (EntityStore& store, Color Color, float radius, float x, float y,float parts);
+
+/* Mirror edges baked from the Mirror store, one entry per slot, so the
+   reflection pass needs no trig. Call mirror_geometry_invalidate after
+   moving, turning or adding a mirror; the next tick rebakes them and
+   retraces the lasers in flight */
+struct MirrorGeometry {
+	float x0, y0;       // the two endpoints
+	float x1, y1;
+	float nx, ny;       // edge normal: the edge vector turned a quarter, as long as the mirror
+	float cos2, sin2;   // reflection matrix [cos2 sin2; sin2 -cos2] for direction vectors
+	float twice_angle;  // a laser at angle a leaves at twice_angle - a
+};
+typedef struct MirrorGeometry MirrorGeometry;
+
+extern std::vector<MirrorGeometry> mirror_geometry;
+
+void mirror_geometry_invalidate ();
+void mirror_geometry_update ();
+
+/* Collision tests and brick bookkeeping behind tick(), also timed by
+   bench.cpp. brick_order_insert files a new brick in the height order and
+   brick_release is store_release for bricks */
+int intersect_point (Point p1, Point p2, Point p4, Point p5);
+bool checkintersection (float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4);
+bool brick_coll_basket (int baskt, int brck);
+void brick_order_insert (int b);
+void brick_release (int b);
+
+/* Seed the game and create the objects every game starts with */
+void initGame (uint64_t seed);
+/* Clear the field for a scene built by hand: every brick and every flying
+   laser is taken out and the score zeroed; guns, baskets and mirrors stay */
+void game_reset ();
+/* Send the loaded laser off at angle and start the reload. Does nothing
+   while no laser is loaded */
+void fireLaser (float angle);
+/* Advance the game by one fixed step of SIM_DT seconds */
+void tick ();
+
+/* Provided by the renderer. The geometry functions return a shared VAO with
+   a reference taken for the new entity, or NULL when nothing is drawn */
+struct VAO* rectangleGeometry (float l, float b);
+struct VAO* circleGeometry (float radius, float parts);
+void geometry_release (struct VAO* vao);
+
+/* Vertices the geometry functions upload, built here without GL so the
+   renderer and bench.cpp run the same code: two triangles of x,y,z, that is
+   GEOMETRY_VERTEX_FLOATS floats. A circle is drawn on the quad around it */
+#define GEOMETRY_VERTEX_FLOATS 18
+void rectangleVertices (float l, float b, float* vertices);
+void circleVertices (float radius, float* vertices);
+
+#endif
@@ -0,0 +1,20 @@
+#include <cstddef>
+
+#include "game_sim.h"
+
+/* The renderer's geometry functions without GL, for the programs that run
+   the game with no renderer linked in (bench2D, test2D); nothing is drawn */
+
+struct VAO* rectangleGeometry (float /*l*/, float /*b*/)
+{
+	return NULL;
+}
+
+struct VAO* circleGeometry (float /*radius*/, float /*parts*/)
+{
+	return NULL;
+}
+
+void geometry_release (struct VAO* /*vao*/)
+{
+}
@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+#include "input_log.h"
+
+using namespace std;
+
+static const char input_log_magic[4] = { 'B', 'B', 'I', 'N' };
+
+static void putVarint (FILE* file, uint64_t value)
+{
+	while(value >= 0x80){
+		fputc((int)(value & 0x7f) | 0x80, file);
+		value >>= 7;
+	}
+	fputc((int)value, file);
+}
+
+static void putFixed (FILE* file, uint64_t value, int bytes)
+{
+	for(int i=0;i<bytes;i++)
+		fputc((int)((value >> (8*i)) & 0xff), file);
+}
+
+static void putDouble (FILE* file, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	putFixed(file, bits, 8);
+}
+
+bool inputLogCreate (InputLog& log, const char* path, uint64_t seed)
+{
+	log.file = fopen(path, "wb");
+	log.last_tick = 0;
+	log.events = 0;
+	if(log.file == NULL)
+		return false;
+	fwrite(input_log_magic, 1, sizeof(input_log_magic), log.file);
+	fputc(INPUT_LOG_VERSION, log.file);
+	putFixed(log.file, seed, 8);
+	return true;
+}
+
+void inputLogWrite (InputLog& log, const InputEvent& event)
+{
+	if(log.file == NULL)
+		return;
+	fputc(event.type, log.file);
+	putVarint(log.file, event.tick - log.last_tick);
+	log.last_tick = event.tick;
+	log.events++;
+
+	switch(event.type){
+		case INPUT_KEY:
+			// Zigzag so GLFW_KEY_UNKNOWN (-1) stays one byte
+			putVarint(log.file, ((uint64_t)event.code << 1) ^ (uint64_t)(int64_t)(event.code >> 31));
+			fputc(event.action, log.file);
+			fputc(event.mods, log.file);
+			break;
+		case INPUT_MOUSE_BUTTON:
+			fputc(event.code, log.file);
+			fputc(event.action, log.file);
+			fputc(event.mods, log.file);
+			break;
+		case INPUT_CURSOR:
+		case INPUT_SCROLL:
+			putDouble(log.file, event.x);
+			putDouble(log.file, event.y);
+			break;
+		default:
+			break;
+	}
+}
+
+void inputLogClose (InputLog& log, long tick)
+{
+	if(log.file == NULL)
+		return;
+	InputEvent end = { tick, INPUT_END, 0, 0, 0, 0, 0 };
+	inputLogWrite(log, end);
+	fclose(log.file);
+	log.file = NULL;
+}
+
+static bool getVarint (FILE* file, uint64_t& value)
+{
+	value = 0;
+	for(int shift=0; shift<64; shift+=7){
+		int c = fgetc(file);
+		if(c == EOF)
+			return false;
+		value |= (uint64_t)(c & 0x7f) << shift;
+		if(!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static bool getFixed (FILE* file, uint64_t& value, int bytes)
+{
+	value = 0;
+	for(int i=0;i<bytes;i++){
+		int c = fgetc(file);
+		if(c == EOF)
+			return false;
+		value |= (uint64_t)c << (8*i);
+	}
+	return true;
+}
+
+static bool getDouble (FILE* file, double& value)
+{
+	uint64_t bits;
+	if(!getFixed(file, bits, 8))
+		return false;
+	memcpy(&value, &bits, sizeof(value));
+	return true;
+}
+
+static bool getByte (FILE* file, int& value)
+{
+	value = fgetc(file);
+	return value != EOF;
+}
+
+bool inputLogLoad (const char* path, uint64_t& seed, vector<InputEvent>& events)
+{
+	FILE* file = fopen(path, "rb");
+	if(file == NULL)
+		return false;
+
+	char magic[4];
+	int version;
+	if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, input_log_magic, sizeof(magic)) != 0
+	   || !getByte(file, version) || version != INPUT_LOG_VERSION || !getFixed(file, seed, 8)){
+		fclose(file);
+		return false;
+	}
+
+	// A session that crashed leaves a log without INPUT_END or with a cut-off
+	// last record; everything before that is still good
+	events.clear();
+	long tick = 0;
+	int type;
+	while(getByte(file, type)){
+		InputEvent event = { 0, type, 0, 0, 0, 0, 0 };
+		uint64_t delta, code;
+		bool ok = getVarint(file, delta);
+		tick += (long)delta;
+		event.tick = tick;
+		switch(type){
+			case INPUT_KEY:
+				ok = ok && getVarint(file, code) && getByte(file, event.action) && getByte(file, event.mods);
+				event.code = (int)(code >> 1) ^ -(int)(code & 1);
+				break;
+			case INPUT_MOUSE_BUTTON:
+				ok = ok && getByte(file, event.code) && getByte(file, event.action) && getByte(file, event.mods);
+				break;
+			case INPUT_CURSOR:
+			case INPUT_SCROLL:
+				ok = ok && getDouble(file, event.x) && getDouble(file, event.y);
+				break;
+			case INPUT_END:
+				break;
+			default:
+				ok = false;
+				break;
+		}
+		if(!ok)
+			break;
+		events.push_back(event);
+		if(type == INPUT_END)
+			break;
+	}
+	fclose(file);
+	return true;
+}
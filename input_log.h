@@ -0,0 +1,58 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+/* Binary log of the input events a session received, each stamped with the
+   simulation tick it was applied before. Together with the seed in the
+   header this is enough to play the session again exactly.
+
+   Layout, all integers little-endian:
+     header  "BBIN", version byte, 8-byte seed
+     record  type byte, tick delta from the previous record as a varint,
+             then the payload:
+               INPUT_KEY           zigzag varint key, action byte, mods byte
+               INPUT_MOUSE_BUTTON  button, action and mods bytes
+               INPUT_CURSOR        x and y as 8-byte doubles
+               INPUT_SCROLL        x and y offsets as 8-byte doubles
+               INPUT_END           nothing; the tick the session stopped at */
+#define INPUT_LOG_VERSION 1
+
+enum InputEventType {
+	INPUT_KEY = 1,
+	INPUT_MOUSE_BUTTON,
+	INPUT_CURSOR,
+	INPUT_SCROLL,
+	INPUT_END
+};
+
+struct InputEvent {
+	long tick;
+	int type;
+	int code;       // key or mouse button
+	int action;
+	int mods;
+	double x, y;    // cursor position or scroll offset
+};
+typedef struct InputEvent InputEvent;
+
+struct InputLog {
+	FILE* file;
+	long last_tick;
+	long events;
+};
+typedef struct InputLog InputLog;
+
+/* Start a log; returns false if the file can't be written */
+bool inputLogCreate (InputLog& log, const char* path, uint64_t seed);
+void inputLogWrite (InputLog& log, const InputEvent& event);
+/* Write the INPUT_END record for the given tick and close the file */
+void inputLogClose (InputLog& log, long tick);
+
+/* Read a whole log. Returns false if the file is missing, not a log, or
+   written by another version */
+bool inputLogLoad (const char* path, uint64_t& seed, std::vector<InputEvent>& events);
+
+#endif
@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+
+#include "jobs.h"
+#include "profile.h"
+
+using namespace std;
+
+struct JobQueue {
+	mutex lock;
+	deque<int> jobs;
+};
+
+static vector<thread> job_threads;
+static JobQueue* job_queues = NULL;
+static int job_worker_count = 1;
+
+// Wakes sleeping workers when jobs are queued or the pool shuts down
+static mutex job_sleep_lock;
+static condition_variable job_wake;
+static atomic<int> job_queued(0);
+static bool job_quit = false;
+
+// The graph being run and what is left of it
+static JobGraph* job_graph = NULL;
+static atomic<int>* job_waiting = NULL;
+static int job_waiting_size = 0;
+static atomic<int> job_remaining(0);
+// Jobs that run after each job, as offsets into job_next
+static vector<int> job_next_start, job_next;
+
+static void job_push (int worker, int job)
+{
+	{
+		lock_guard<mutex> guard(job_queues[worker].lock);
+		job_queues[worker].jobs.push_back(job);
+	}
+	job_queued++;
+	{
+		lock_guard<mutex> guard(job_sleep_lock);
+	}
+	job_wake.notify_one();
+}
+
+/* Newest job from our own deque, else the oldest one of another worker */
+static bool job_take (int worker, int& job)
+{
+	for(int k=0;k<job_worker_count;k++){
+		JobQueue& queue = job_queues[(worker + k) % job_worker_count];
+		lock_guard<mutex> guard(queue.lock);
+		if(queue.jobs.empty())
+			continue;
+		if(k == 0){
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+		}
+		else{
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+		job_queued--;
+		return true;
+	}
+	return false;
+}
+
+static void job_execute (int worker, int j)
+{
+	const Job& job = job_graph->jobs[j];
+	job.func(job.data, job.begin, job.end, worker);
+	for(int e=job_next_start[j];e<job_next_start[j+1];e++)
+		if(--job_waiting[job_next[e]] == 0)
+			job_push(worker, job_next[e]);
+	job_remaining--;
+}
+
+static void job_worker (int worker)
+{
+	if(profile_enabled){
+		char name[32];
+		snprintf(name, sizeof(name), "job worker %d", worker);
+		profile_thread_name(name);
+	}
+	for(;;){
+		int j;
+		if(job_take(worker, j)){
+			job_execute(worker, j);
+			continue;
+		}
+		unique_lock<mutex> guard(job_sleep_lock);
+		job_wake.wait(guard, []{ return job_quit || job_queued > 0; });
+		if(job_quit)
+			return;
+	}
+}
+
+void jobs_init (int threads)
+{
+	if(threads <= 0)
+		threads = (int)thread::hardware_concurrency();
+	if(threads < 1)
+		threads = 1;
+	jobs_shutdown();
+	job_worker_count = threads;
+	job_queues = new JobQueue[threads];
+	job_quit = false;
+	for(int w=1;w<threads;w++)
+		job_threads.push_back(thread(job_worker, w));
+
+	static bool registered = false;
+	if(!registered){
+		// The game can exit() from the middle of a tick; join the workers first
+		atexit(jobs_shutdown);
+		registered = true;
+	}
+}
+
+void jobs_shutdown ()
+{
+	{
+		lock_guard<mutex> guard(job_sleep_lock);
+		job_quit = true;
+	}
+	job_wake.notify_all();
+	for(size_t i=0;i<job_threads.size();i++)
+		job_threads[i].join();
+	job_threads.clear();
+	delete[] job_queues;
+	job_queues = NULL;
+	job_worker_count = 1;
+}
+
+int jobs_workers ()
+{
+	return job_worker_count;
+}
+
+void job_clear (JobGraph& graph)
+{
+	graph.jobs.clear();
+	graph.edge_from.clear();
+	graph.edge_to.clear();
+}
+
+int job_add (JobGraph& graph, JobFunc func, void* data, int begin, int end)
+{
+	Job job = { func, data, begin, end, 0 };
+	graph.jobs.push_back(job);
+	return (int)graph.jobs.size() - 1;
+}
+
+int job_add_range (JobGraph& graph, JobFunc func, void* data, int n, int grain)
+{
+	int first = (int)graph.jobs.size();
+	for(int begin=0;begin<n;begin+=grain)
+		job_add(graph, func, data, begin, begin+grain < n ? begin+grain : n);
+	return first;
+}
+
+void job_after (JobGraph& graph, int job, int dependency)
+{
+	graph.edge_from.push_back(dependency);
+	graph.edge_to.push_back(job);
+	graph.jobs[job].deps++;
+}
+
+void jobs_run (JobGraph& graph, bool parallel)
+{
+	int n = (int)graph.jobs.size();
+	if(!parallel || job_threads.empty()){
+		for(int j=0;j<n;j++)
+			graph.jobs[j].func(graph.jobs[j].data, graph.jobs[j].begin, graph.jobs[j].end, 0);
+		return;
+	}
+
+	// Turn the edge list into per-job lists of the jobs that wait on it
+	job_next_start.assign(n+1, 0);
+	for(size_t e=0;e<graph.edge_from.size();e++)
+		job_next_start[graph.edge_from[e]+1]++;
+	for(int j=0;j<n;j++)
+		job_next_start[j+1] += job_next_start[j];
+	job_next.resize(graph.edge_from.size());
+	vector<int> fill(job_next_start.begin(), job_next_start.end()-1);
+	for(size_t e=0;e<graph.edge_from.size();e++)
+		job_next[fill[graph.edge_from[e]]++] = graph.edge_to[e];
+
+	if(job_waiting_size < n){
+		delete[] job_waiting;
+		job_waiting = new atomic<int>[n];
+		job_waiting_size = n;
+	}
+	for(int j=0;j<n;j++)
+		job_waiting[j] = graph.jobs[j].deps;
+	job_graph = &graph;
+	job_remaining = n;
+
+	// Deal the ready jobs out round robin; stealing evens out the rest
+	int next = 0;
+	for(int j=0;j<n;j++)
+		if(graph.jobs[j].deps == 0)
+			job_push(next++ % job_worker_count, j);
+
+	while(job_remaining > 0){
+		int j;
+		if(job_take(0, j))
+			job_execute(0, j);
+		else
+			this_thread::yield();
+	}
+	job_graph = NULL;
+}
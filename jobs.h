@@ -0,0 +1,49 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <vector>
+
+/* Small work-stealing job system. A JobGraph is a list of jobs, each a
+   function over an index range, and the order constraints between them.
+   jobs_run hands the ready jobs out to one deque per thread; a thread
+   works its own deque from the back and steals from the front of the
+   others when it runs dry. The calling thread takes part as worker 0 and
+   returns once every job has finished. */
+
+typedef void (*JobFunc) (void* data, int begin, int end, int worker);
+
+struct Job {
+	JobFunc func;
+	void* data;
+	int begin, end;
+	int deps;       // jobs that have to finish before this one starts
+};
+typedef struct Job Job;
+
+struct JobGraph {
+	std::vector<Job> jobs;
+	// Job edge_to[i] runs after job edge_from[i]
+	std::vector<int> edge_from, edge_to;
+};
+typedef struct JobGraph JobGraph;
+
+/* Start threads-1 worker threads; 0 picks one per hardware thread. Without
+   jobs_init every graph runs on the calling thread */
+void jobs_init (int threads);
+void jobs_shutdown ();
+/* Threads that run jobs, the caller of jobs_run included */
+int jobs_workers ();
+
+void job_clear (JobGraph& graph);
+int job_add (JobGraph& graph, JobFunc func, void* data, int begin, int end);
+/* Add jobs covering [0,n) in chunks of at most grain; returns the first */
+int job_add_range (JobGraph& graph, JobFunc func, void* data, int n, int grain);
+/* Make job wait for dependency. Dependencies must be added before the jobs
+   that wait on them, so the order jobs were added in is always safe */
+void job_after (JobGraph& graph, int job, int dependency);
+
+/* Run the graph and wait for it. With parallel false, or no worker threads,
+   the jobs run one after another on the caller in the order they were added */
+void jobs_run (JobGraph& graph, bool parallel);
+
+#endif
@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "profile.h"
+
+using namespace std;
+
+struct ProfileEvent {
+	const char* name;
+	uint64_t start, end;
+	bool counter;       // a counter sample of value at start, not a scope
+	double value;
+};
+typedef struct ProfileEvent ProfileEvent;
+
+/* Written only by its own thread; written counts every event ever recorded,
+   so event k sits at k % PROFILE_RING_EVENTS */
+struct ProfileRing {
+	ProfileEvent events[PROFILE_RING_EVENTS];
+	atomic<uint64_t> written;
+	char name[32];
+};
+typedef struct ProfileRing ProfileRing;
+
+bool profile_enabled = false;
+static uint64_t profile_origin = 0;
+
+// Every thread's ring, kept after the thread ends so its events still export
+static mutex profile_rings_lock;
+static vector<ProfileRing*> profile_rings;
+static thread_local ProfileRing* profile_ring = NULL;
+
+/* The calling thread's ring, made on first use */
+static ProfileRing* profile_thread_ring ()
+{
+	if(profile_ring == NULL){
+		profile_ring = new ProfileRing;
+		profile_ring->written = 0;
+		lock_guard<mutex> guard(profile_rings_lock);
+		snprintf(profile_ring->name, sizeof(profile_ring->name), "thread %d", (int)profile_rings.size());
+		profile_rings.push_back(profile_ring);
+	}
+	return profile_ring;
+}
+
+void profile_enable ()
+{
+	profile_origin = profile_now();
+	profile_enabled = true;
+}
+
+void profile_thread_name (const char* name)
+{
+	ProfileRing* ring = profile_thread_ring();
+	lock_guard<mutex> guard(profile_rings_lock);
+	snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+void profile_record (const char* name, uint64_t start, uint64_t end)
+{
+	ProfileRing* ring = profile_thread_ring();
+	uint64_t k = ring->written.load(memory_order_relaxed);
+	ProfileEvent& event = ring->events[k % PROFILE_RING_EVENTS];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	event.counter = false;
+	ring->written.store(k+1, memory_order_release);
+}
+
+void profile_counter (const char* name, uint64_t at, double value)
+{
+	if(!profile_enabled)
+		return;
+	ProfileRing* ring = profile_thread_ring();
+	uint64_t k = ring->written.load(memory_order_relaxed);
+	ProfileEvent& event = ring->events[k % PROFILE_RING_EVENTS];
+	event.name = name;
+	event.start = event.end = at;
+	event.counter = true;
+	event.value = value;
+	ring->written.store(k+1, memory_order_release);
+}
+
+/* Scope names are literals from the source, but keep the JSON valid anyway */
+static void profile_write_string (FILE* file, const char* s)
+{
+	fputc('"', file);
+	for(;*s;s++){
+		if(*s == '"' || *s == '\\')
+			fputc('\\', file);
+		if((unsigned char)*s >= ' ')
+			fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+bool profile_write_trace (const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if(file == NULL)
+		return false;
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first = true;
+
+	lock_guard<mutex> guard(profile_rings_lock);
+	vector<ProfileEvent> events;
+	for(size_t r=0;r<profile_rings.size();r++){
+		ProfileRing* ring = profile_rings[r];
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", (int)r);
+		profile_write_string(file, ring->name);
+		fprintf(file, "}}");
+		first = false;
+
+		/* Copy the ring up to the last event published, then drop whatever
+		   its thread may have written over while we were copying. The slot
+		   after the last one published may be half written, so it counts as
+		   written over too */
+		uint64_t end = ring->written.load(memory_order_acquire);
+		uint64_t begin = end > PROFILE_RING_EVENTS ? end - PROFILE_RING_EVENTS : 0;
+		events.clear();
+		for(uint64_t k=begin;k<end;k++)
+			events.push_back(ring->events[k % PROFILE_RING_EVENTS]);
+		uint64_t now = ring->written.load(memory_order_acquire) + 1;
+		size_t skip = now > PROFILE_RING_EVENTS && now - PROFILE_RING_EVENTS > begin ? (size_t)(now - PROFILE_RING_EVENTS - begin) : 0;
+
+		for(size_t e=skip;e<events.size();e++){
+			// Scopes entered before profile_enable started have no place on the timeline
+			if(events[e].start < profile_origin)
+				continue;
+			fprintf(file, ",\n{\"name\":");
+			profile_write_string(file, events[e].name);
+			if(events[e].counter){
+				fprintf(file, ",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+				        (int)r, (events[e].start - profile_origin)/1000.0, events[e].value);
+				continue;
+			}
+			fprintf(file, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			        (int)r, (events[e].start - profile_origin)/1000.0, (events[e].end - events[e].start)/1000.0);
+		}
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return fclose(file) == 0;
+}
@@ -0,0 +1,58 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <chrono>
+
+/* Scoped CPU phase timers. A PROFILE_SCOPE records when it was entered and
+   left into a ring buffer owned by the calling thread, so recording takes
+   no lock and threads never wait on each other; each ring keeps the last
+   PROFILE_RING_EVENTS scopes and overwrites older ones. profile_write_trace
+   saves what the rings hold as Chrome trace JSON, which chrome://tracing and
+   ui.perfetto.dev open. Until profile_enable is called a scope costs one
+   test of profile_enabled. Counters put measured values, such as GPU
+   times, on the same timeline. */
+
+#define PROFILE_RING_EVENTS 65536
+
+extern bool profile_enabled;
+
+/* Start recording; timestamps in the trace count from this call */
+void profile_enable ();
+/* Name the calling thread in the trace */
+void profile_thread_name (const char* name);
+void profile_record (const char* name, uint64_t start, uint64_t end);
+/* Plot value on the counter track name at profile_now() time at; does
+   nothing while profiling is off */
+void profile_counter (const char* name, uint64_t at, double value);
+/* Write the recorded scopes of every thread. Returns false if the file
+   can't be written. Call it while the other threads are idle, between job
+   graphs or after jobs_shutdown: events a thread records during the write
+   are dropped or may come out garbled */
+bool profile_write_trace (const char* path);
+
+inline uint64_t profile_now ()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Times the enclosing block. name must outlive the trace, so pass a string
+   literal */
+class ProfileScope {
+public:
+	ProfileScope (const char* name) : name(name), start(profile_enabled ? profile_now() : 0) {}
+	~ProfileScope ()
+	{
+		if(start != 0)
+			profile_record(name, start, profile_now());
+	}
+private:
+	const char* name;
+	uint64_t start;
+};
+
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profile_scope_, line)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_NAME(__LINE__)(name)
+
+#endif
@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "game_sim.h"
+#include "jobs.h"
+
+using namespace std;
+
+/* Headless checks of game rules that are easy to break without noticing in
+   play. The tests share one game, with a mirror added at the origin turned
+   to 45 degrees so a laser along y = 0 bounces straight up. Each test sets
+   up its scene, plays a few ticks and checks what happened; the program
+   prints one line per test and exits non-zero if any failed. */
+
+static int test_failures = 0;
+
+static void test_check (const char* name, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+	if(!ok)
+		test_failures++;
+}
+
+/* An empty field with a laser flying along y = 0 at speed 1 per tick
+   towards the mirror. The laser is 0.3 long and starts 2.5 before the
+   mirror, so after two ticks its head is at x = -0.35 and on the third it
+   has bounced */
+static int test_mirror_scene ()
+{
+	game_reset();
+	Color red = {1,0,0};
+	EntityHandle laser = createRectangle(Laser, red, 0.15, 0.04, -2.5, 0, 0);
+	Laser.status[laser.index] = 1;
+	Laser.speed[laser.index] = 1;
+	return laser.index;
+}
+
+/* A brick in the stretch between where the head was the tick before the
+   bounce and the mirror must be hit, not tunnelled through */
+static void test_brick_before_mirror ()
+{
+	int laser = test_mirror_scene();
+	Color black = {0,0,0};
+	EntityHandle brick = createRectangle(Brick, black, 0.08, 0.18, -0.2, 0, 0);
+	brick_order_insert(brick.index);
+	for(int t=0;t<3;t++)
+		tick();
+	test_check("laser hits a brick just before the mirror it bounces off",
+	           Brick.flag[brick.index] == -1 && Laser.flag[laser] == -1 && points == 10);
+}
+
+/* After the bounce the laser goes on to hit what is on its new leg */
+static void test_brick_after_mirror ()
+{
+	int laser = test_mirror_scene();
+	Color black = {0,0,0};
+	EntityHandle brick = createRectangle(Brick, black, 0.08, 0.18, 0, 1, 0);
+	brick_order_insert(brick.index);
+	for(int t=0;t<10;t++)
+		tick();
+	test_check("laser hits a brick on the leg after a bounce",
+	           Brick.flag[brick.index] == -1 && Laser.flag[laser] == -1 && points == 10);
+}
+
+int main (int argc, char** argv)
+{
+	int threads = 1;
+	for(int i=1;i<argc;i++){
+		if(strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+			threads = atoi(argv[++i]);
+		else{
+			fprintf(stderr, "usage: %s [--threads N]\n", argv[0]);
+			return 2;
+		}
+	}
+	jobs_init(threads);
+	initGame(GAME_DEFAULT_SEED);
+	Color white = {1,1,1};
+	createRectangle(Mirror, white, 0.45, 0.04, 0, 0, 45);
+	mirror_geometry_invalidate();
+
+	test_brick_before_mirror();
+	test_brick_after_mirror();
+
+	jobs_shutdown();
+	return test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include <vector>
+
+#include "timers.h"
+
+using namespace std;
+
+void timer_wheel_init (TimerWheel& wheel, long now)
+{
+	wheel.now = now;
+	wheel.seq = 0;
+	wheel.timers.clear();
+	wheel.free_timer = -1;
+	wheel.due.clear();
+	for(int l=0;l<TIMER_LEVELS;l++)
+		for(int s=0;s<TIMER_SLOTS;s++)
+			wheel.head[l][s] = wheel.tail[l][s] = -1;
+}
+
+/* File timer i by how far off it is from the tick being run. Past the top
+   level's reach it waits in the farthest slot and is filed again from there */
+static void timer_place (TimerWheel& wheel, int i)
+{
+	long due = wheel.timers[i].due;
+	long delta = due - wheel.now;
+	int level = 0;
+	while(level < TIMER_LEVELS-1 && delta >= (1L << (TIMER_BITS*(level+1))))
+		level++;
+	if(delta >= (1L << (TIMER_BITS*TIMER_LEVELS)))
+		due = wheel.now + (1L << (TIMER_BITS*TIMER_LEVELS)) - 1;
+	int slot = (int)((due >> (TIMER_BITS*level)) & (TIMER_SLOTS-1));
+
+	wheel.timers[i].next = -1;
+	if(wheel.tail[level][slot] == -1)
+		wheel.head[level][slot] = i;
+	else
+		wheel.timers[wheel.tail[level][slot]].next = i;
+	wheel.tail[level][slot] = i;
+}
+
+void timer_schedule (TimerWheel& wheel, long due, TimerFunc func, void* data)
+{
+	if(due <= wheel.now)
+		due = wheel.now + 1;
+	int i = wheel.free_timer;
+	if(i == -1){
+		wheel.timers.push_back(Timer());
+		i = (int)wheel.timers.size() - 1;
+	}
+	else
+		wheel.free_timer = wheel.timers[i].next;
+	Timer& timer = wheel.timers[i];
+	timer.due = due;
+	timer.seq = wheel.seq++;
+	timer.func = func;
+	timer.data = data;
+	timer_place(wheel, i);
+}
+
+/* Take the list out of a slot */
+static int timer_take (TimerWheel& wheel, int level, int slot)
+{
+	int i = wheel.head[level][slot];
+	wheel.head[level][slot] = wheel.tail[level][slot] = -1;
+	return i;
+}
+
+void timer_advance (TimerWheel& wheel, long now)
+{
+	while(wheel.now < now){
+		wheel.now++;
+
+		// Entering a new span of a higher level: spread its timers out below
+		for(int l=TIMER_LEVELS-1;l>0;l--){
+			if((wheel.now & ((1L << (TIMER_BITS*l)) - 1)) != 0)
+				continue;
+			int i = timer_take(wheel, l, (int)((wheel.now >> (TIMER_BITS*l)) & (TIMER_SLOTS-1)));
+			while(i != -1){
+				int next = wheel.timers[i].next;
+				timer_place(wheel, i);
+				i = next;
+			}
+		}
+
+		int i = timer_take(wheel, 0, (int)(wheel.now & (TIMER_SLOTS-1)));
+		if(i == -1)
+			continue;
+		wheel.due.clear();
+		for(;i!=-1;i=wheel.timers[i].next){
+			// Keep them in scheduling order
+			size_t k = wheel.due.size();
+			wheel.due.push_back(i);
+			while(k > 0 && wheel.timers[wheel.due[k-1]].seq > wheel.timers[i].seq){
+				wheel.due[k] = wheel.due[k-1];
+				k--;
+			}
+			wheel.due[k] = i;
+		}
+		// Free them before firing, so a timer can reschedule itself
+		vector<Timer> fire;
+		for(size_t k=0;k<wheel.due.size();k++){
+			fire.push_back(wheel.timers[wheel.due[k]]);
+			wheel.timers[wheel.due[k]].next = wheel.free_timer;
+			wheel.free_timer = wheel.due[k];
+		}
+		for(size_t k=0;k<fire.size();k++)
+			fire[k].func(fire[k].data);
+	}
+}
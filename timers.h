@@ -0,0 +1,48 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <vector>
+
+/* Hierarchical timer wheel counted in simulation ticks. Level 0 has a slot
+   per tick for the next TIMER_SLOTS ticks, and each level above covers
+   TIMER_SLOTS times the span of the one below. Scheduling drops a timer
+   into one slot; when the wheel turns into a slot of a higher level, the
+   timers there are spread over the levels below. Both are O(1) per timer,
+   and a tick with nothing due costs a single empty slot check. */
+
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+
+typedef void (*TimerFunc) (void* data);
+
+struct Timer {
+	long due;
+	unsigned long seq;   // order timers were scheduled in
+	TimerFunc func;
+	void* data;
+	int next;            // next timer in the same slot, or free timer; -1 ends the list
+};
+typedef struct Timer Timer;
+
+struct TimerWheel {
+	long now;            // last tick run
+	unsigned long seq;
+	std::vector<Timer> timers;
+	int free_timer;
+	int head[TIMER_LEVELS][TIMER_SLOTS];
+	int tail[TIMER_LEVELS][TIMER_SLOTS];
+	std::vector<int> due;
+};
+typedef struct TimerWheel TimerWheel;
+
+/* Empty the wheel; the next tick to run is now+1 */
+void timer_wheel_init (TimerWheel& wheel, long now);
+/* Call func(data) when tick `due` runs; a tick already run means the next
+   one */
+void timer_schedule (TimerWheel& wheel, long due, TimerFunc func, void* data);
+/* Run the ticks up to and including `now`, firing the timers due on each in
+   the order they were scheduled. Timers may schedule more timers */
+void timer_advance (TimerWheel& wheel, long now);
+
+#endif